@@ -26,6 +26,8 @@ for all files so that.
 #define MAX_TIMESTAMP_LEN 48    /**< \brief Max length of a timestamp string */
 #define MAX_QUERY_LEN 512       /**< \brief Max length of an SQL query */
 #define MAX_FORTH_LEN 512       /**< \brief Max length of a Forth string to execute */
+#define PARAM_SSO_LEN 24        /**< \brief Strings shorter than this are stored inside their Param */
+#define RETURN_STACK_CAPACITY 4096  /**< \brief Slots in the return stack (one per call, two per loop) */
 
 #define STR_TO_INT(_string_) \
     ((_string_) ? g_ascii_strtoll((_string_), NULL, 10) : 0)
@@ -56,58 +58,333 @@ typedef void (*routine_ptr)(gpointer entry);  /**< \brief Function pointer type
 typedef void (*free_custom_val_ptr)(gpointer val_custom);
 typedef gpointer (*copy_custom_val_ptr)(gpointer val_custom);
 
+/** \brief Stack effect of an entry: ( num_in -- num_out )
+
+Primitives declare their effects (see declare_effect), and the effects of
+definitions are inferred when they are compiled (see stack_effect.c).
+*/
+typedef struct {
+    gboolean known;             /**< \brief 1 if declared or inferred; 0 if unknown (e.g., it varies) */
+    guint num_in;               /**< \brief Number of params the entry needs (and pops) */
+    guint num_out;              /**< \brief Number of params the entry pushes in their place */
+} StackEffect;
+
+
 /** \brief Structure of Dictionary entries
 */
 typedef struct {
     gchar word[MAX_WORD_LEN];   /**< \brief Key used for Dictionary lookup */
     gboolean immediate;         /**< \brief 1 if should be executed during compilation; 0 otherwise */
     gboolean complete;          /**< \brief 1 if completely defined; 0 if being defined */
-    GSequence *params;          /**< \brief Sequence of Param objects */
+    gboolean parsing;           /**< \brief 1 if the routine reads from the input stream; 0 otherwise */
+    gboolean pure;              /**< \brief 1 if the routine only replaces effect.num_in numbers with one result; 0 otherwise */
+    StackEffect effect;         /**< \brief Stack effect (see effect.known for whether it is known) */
+    GSequence *params;          /**< \brief Sequence of Param objects (e.g., variable and constant values) */
+    GArray *code;               /**< \brief Array of Cell objects for a definition (NULL otherwise) */
+    GArray *int_code;           /**< \brief Version of code for integer inputs (NULL if none; see specialize.c) */
     routine_ptr routine;        /**< \brief Code to be run when Entry is executed */
+    const struct Dictionary *dictionary;  /**< \brief Dictionary that owns the entry (NULL if none) */
 } Entry;
 
 
+typedef struct CustomType CustomType;
+
+
+/** \brief Shared payload of custom Params
+
+Copies of a custom Param share one box. The payload is freed with its type's
+free_custom when the last reference goes away, and is only copied (with
+copy_custom) when a Param that shares it needs to modify it (see
+make_custom_writable).
+*/
+typedef struct {
+    gint ref_count;                      /**< \brief Number of Params sharing this box (atomic) */
+    gpointer val_custom;                 /**< \brief Custom data */
+} CustomBox;
+
+
 /** \brief Structure of objects that go onto the stack or are part of an Entry
 
-A Param struct has all possible fields for values that a parameter might have.
-Its "type" is a character that indicates which field holds the parameter's value:
+A Param is a tagged union. Its "type" is a character that indicates which
+field holds the parameter's value:
 
 \anchor param_types
 
 - 'I': Integer value
 - 'D': Double value
-- 'S': String value (*must* be dynamically allocated because it will be freed when the parameter is freed)
-- 'E': Points to an Entry in _dictionary
+- 'S': Immutable string value (short strings are stored inline in val_sso; longer ones are shared by copies)
+- 'E': Points to an Entry in a dictionary
+- 'Q': Quotation; points to an anonymous Entry with compiled code (see "[:")
 - 'R': Routine pointer
-- 'P': Pseudo entry
-- 'C': Custom data
+- 'C': Custom data (shared between copies; see CustomBox)
 
+\note Since val_string may point into the Param itself, Params must not be
+      copied by value. Use copy_param instead.
 */
 typedef struct {
     gchar type;               /**< \brief Indicates type of Param (see \ref param_types "Param types") */
 
-    gint64 val_int;           /**< \brief Integer value of an 'I' param */
-    gdouble val_double;       /**< \brief Double value of a 'D' param */
-    gchar *val_string;        /**< \brief String value of an 'S' param */
-    gpointer val_entry;       /**< \brief Entry pointer value of an 'E' param */
-    routine_ptr val_routine;  /**< \brief Routine ptr of an 'R' param */
-    Entry val_pseudo_entry;   /**< \brief Pseudo Entry of a 'P' param */
+    union {
+        gint64 val_int;           /**< \brief Integer value of an 'I' param */
+        gdouble val_double;       /**< \brief Double value of a 'D' param */
+        gpointer val_entry;       /**< \brief Entry pointer value of an 'E' or 'Q' param */
+        routine_ptr val_routine;  /**< \brief Routine ptr of an 'R' param */
 
-    gpointer val_custom;      /**< \brief Custom data that is freed by free_custom */
-    free_custom_val_ptr free_custom;     /**< \brief Frees custom data */
-    copy_custom_val_ptr copy_custom;     /**< \brief Frees custom data */
-    gchar val_custom_type[MAX_WORD_LEN];  /**< \brief Describes custom data */ 
+        struct {
+            const gchar *val_string;       /**< \brief Immutable string value of an 'S' param (points to val_sso or a shared buffer) */
+            gchar val_sso[PARAM_SSO_LEN];  /**< \brief Inline storage for short strings */
+        };
+
+        struct {
+            gpointer val_custom;                 /**< \brief Custom data (same as val_box->val_custom); treat as read-only */
+            CustomBox *val_box;                  /**< \brief Shared, reference-counted payload */
+            const CustomType *val_custom_type;   /**< \brief Describes custom data */
+        };
+    };
 } Param;
 
 
+typedef void (*print_param_func)(FILE *file, Param *param);
+typedef Param *(*get_field_func)(const Param *param, const gchar *field_name);
+typedef gboolean (*set_field_func)(const Param *param, const gchar *field_name, const Param *value);
+
+/** \brief Descriptor for a type of custom data
+
+Each lexicon defines one of these for each of its custom types and registers it
+with add_custom_type. Custom Params point to their descriptor, so creating,
+copying, freeing, and printing them doesn't involve looking anything up.
+
+The print, get_field, and set_field functions are optional.
+*/
+struct CustomType {
+    const gchar *name;                   /**< \brief Type name (e.g., "Task" or "[Task]") */
+    free_custom_val_ptr free_custom;     /**< \brief Frees custom data */
+    copy_custom_val_ptr copy_custom;     /**< \brief Copies custom data */
+    print_param_func print;              /**< \brief Prints a Param of this type */
+    get_field_func get_field;            /**< \brief Returns a new Param with the value of a field (or NULL if no such field) */
+    set_field_func set_field;            /**< \brief Sets the value of a field, returning FALSE if no such field */
+};
+
+
+/** \brief A slot of the parameter stack
+
+Integer ('I'), double ('D'), entry ('E'), quotation ('Q') and sequence start
+('[') values are stored inline so pushing and popping them doesn't touch the heap. All other
+values are boxed in a Param owned by the stack.
+*/
+typedef struct {
+    gchar type;                 /**< \brief Type of the value (see \ref param_types "Param types") */
+    union {
+        gint64 val_int;         /**< \brief Value of an inline 'I' cell */
+        gdouble val_double;     /**< \brief Value of an inline 'D' cell */
+        gpointer val_entry;     /**< \brief Value of an inline 'E' or 'Q' cell */
+        Param *val_param;       /**< \brief Boxed Param for all other types */
+    };
+} StackCell;
+
+
+/** \brief Parameter stack: a growable array of StackCell objects (top is at depth-1)
+*/
+typedef struct {
+    StackCell *cells;           /**< \brief Contiguous array of cells */
+    guint depth;                /**< \brief Number of cells in use */
+    guint capacity;             /**< \brief Number of cells allocated */
+} Stack;
+
+
+/** \brief Operations in the compiled code of a definition
+
+\anchor cell_ops
+
+- OP_CALL: Executes the cell's entry
+- OP_PUSH_LITERAL: Pushes a copy of the cell's literal onto the stack
+- OP_JMP: Moves the instruction pointer by the cell's jmp_offset
+- OP_JMP_IF_FALSE: Pops a param and jmps by jmp_offset if it is false
+- OP_RETURN: Returns from the definition
+- OP_TAIL_CALL: Executes the cell's entry (a definition) in place of the
+  current one; used for calls just before OP_RETURN
+- OP_DO: Pops a start index and a limit. If start < limit, pushes the limit and
+  the index onto the return stack and enters the loop; otherwise, jmps by
+  jmp_offset (past the loop)
+- OP_LOOP: Increments the innermost loop index and jmps by jmp_offset (back to
+  the start of the loop body) until it reaches the limit; then drops the loop
+- OP_LOOP_INDEX: Pushes the index of the loop loop_level levels out from the
+  innermost one ("i" is 0; "j" is 1)
+
+In definitions whose stack effects have been verified (see stack_effect.c), calls
+to some stack words are replaced with ops that don't check the stack depth.
+The depth is checked once when the definition is entered instead. These ops
+keep the entry for the word they replace:
+
+- OP_DUP: "dup"
+- OP_SWAP: "swap"
+- OP_DROP: "pop"
+
+Definitions that only make integers from integers also get a version of their
+code that skips type checks (see specialize.c). It uses these ops in place of
+the generic ones:
+
+- OP_INT_LITERAL: Pushes the integer val_int
+- OP_INT_JMP_IF_FALSE: Pops an integer and jmps by jmp_offset if it is 0
+- OP_INT_CALL: Executes the integer code of entry without checking its inputs
+- OP_INT_ADD, OP_INT_SUBTRACT, OP_INT_MULTIPLY: Replace the top two integers
+  with their sum, difference, or product; entry is the word they replace
+- OP_INT_EQUAL, OP_INT_NOT_EQUAL, OP_INT_LESS, OP_INT_GREATER,
+  OP_INT_LESS_EQUAL, OP_INT_GREATER_EQUAL: Replace the top two integers with 1
+  or 0; entry is the word they replace
+
+Superinstructions are produced by the peephole optimizer (see optimize.c) from
+common pairs of cells:
+
+- OP_LITERAL_CALL: Pushes a copy of the literal and executes the entry
+- OP_FETCH_VARIABLE: Pushes a copy of the value of the variable in entry ("var @")
+- OP_GET_FIELD: Replaces the custom value on top of the stack with its field
+  named by the literal ("'name' @field"); entry is "@field", used for errors
+*/
+typedef enum {
+    OP_CALL,
+    OP_PUSH_LITERAL,
+    OP_JMP,
+    OP_JMP_IF_FALSE,
+    OP_RETURN,
+    OP_TAIL_CALL,
+    OP_DO,
+    OP_LOOP,
+    OP_LOOP_INDEX,
+    OP_DUP,
+    OP_SWAP,
+    OP_DROP,
+    OP_INT_LITERAL,
+    OP_INT_JMP_IF_FALSE,
+    OP_INT_CALL,
+    OP_INT_ADD,
+    OP_INT_SUBTRACT,
+    OP_INT_MULTIPLY,
+    OP_INT_EQUAL,
+    OP_INT_NOT_EQUAL,
+    OP_INT_LESS,
+    OP_INT_GREATER,
+    OP_INT_LESS_EQUAL,
+    OP_INT_GREATER_EQUAL,
+    OP_LITERAL_CALL,
+    OP_FETCH_VARIABLE,
+    OP_GET_FIELD,
+    NUM_CELL_OPS
+} CellOp;
+
+
+/** \brief One instruction of a compiled definition
+
+Definitions are compiled into a contiguous array of cells. Jump offsets are
+relative to the jmp cell itself, so the array can grow (and move) while a
+definition is being compiled.
+*/
+typedef struct {
+    CellOp op;                  /**< \brief What the cell does (see \ref cell_ops "Cell ops") */
+    union {
+        Entry *entry;           /**< \brief Entry to execute (or variable to fetch) */
+        gint64 jmp_offset;      /**< \brief Cells to move from this one for jmps, OP_DO, and OP_LOOP */
+        gint64 val_int;         /**< \brief Integer pushed by OP_INT_LITERAL */
+        guint loop_level;       /**< \brief Loop whose index OP_LOOP_INDEX pushes (0 is the innermost) */
+    };
+    Param *literal;             /**< \brief Param owned by the cell (NULL if the op has no literal) */
+} Cell;
+
+
+/** \brief A slot of the return stack
+
+Calls push a return address. Loops (see "do") push their limit and then their
+index, so the index of the innermost loop is on top while its body runs.
+*/
+typedef union {
+    Cell *ip;                   /**< \brief Return address */
+    gint64 val_int;             /**< \brief Loop limit or index */
+} ReturnSlot;
+
+
+/** \brief Return stack: a fixed-capacity array of ReturnSlot objects (top is at depth-1)
+*/
+typedef struct {
+    ReturnSlot *slots;          /**< \brief Contiguous array of slots */
+    guint depth;                /**< \brief Number of slots in use */
+    guint capacity;             /**< \brief Number of slots allocated (pushing more is an error) */
+} ReturnStack;
+
+
+/** \brief A layer of words
+
+Each interpreter (KitVM) defines its words in its own dictionary. Words that
+aren't found there are looked up in its parent, which ends with the shared base
+dictionary of builtin words (see build_dictionary). Parents aren't modified
+while interpreters that use them are running.
+*/
+typedef struct Dictionary {
+    GList *entries;                     /**< \brief Entry objects in the order they were added */
+    GList *tail;                        /**< \brief Last link of entries */
+    GHashTable *index;                  /**< \brief Maps word to a GSList of Entry objects (newest first) */
+    guint generation;                   /**< \brief Changes whenever word lookups could give a different result */
+    GSList *anonymous_entries;          /**< \brief Entries without words (e.g., quotations) */
+    const struct Dictionary *parent;    /**< \brief Where words not defined here are looked up (NULL for the base) */
+} Dictionary;
+
+
+typedef struct StringCache StringCache;
+
+
+/** \brief State of one interpreter
+
+Everything an interpreter changes as it runs lives here, so several
+interpreters can run in one process, each on its own thread. The interpreter
+that a thread is running is _vm (see use_vm).
+*/
+typedef struct {
+    Dictionary *dictionary;     /**< \brief Words defined by this interpreter */
+    Stack *stack;               /**< \brief Param stack */
+    ReturnStack *return_stack;  /**< \brief Return stack */
+    Cell *ip;                   /**< \brief Next instruction (Cell) to execute in a definition */
+
+    /** Interpreter mode. The legal values are:
+
+        - E: Execution mode (normal)
+        - C: Compilation mode (during word definition)
+    */
+    gchar mode;
+    gboolean quit;              /**< \brief To quit the interpreter cleanly, set quit=1 */
+    gboolean error;             /**< \brief Set by handle_error (e.g., so run_chunks knows a chunk failed) */
+    gboolean read_only_vars;    /**< \brief Set if "!" may only store in variables this interpreter defined */
+    jmp_buf error_jmp_buf;      /**< \brief Jump buffer for error handling */
+
+    GSList *quotation_frames;   /**< \brief Open quotations (innermost first; see "[:") */
+    GSList *control_frames;     /**< \brief Indexes left by control words like "if" (innermost first) */
+    StringCache *string_cache;  /**< \brief Compiled code for strings (see string_cache.c) */
+    GPtrArray *input_sources;   /**< \brief Pool of input sources (index 0 is the outermost; see forth.l) */
+    guint input_depth;          /**< \brief Number of active input sources */
+    Param top_scratch;          /**< \brief Returned by top() for inline cells */
+    FILE *out;                  /**< \brief Where the interpreter prints (stdout unless redirected) */
+    FILE *err;                  /**< \brief Where the interpreter reports errors (stderr unless redirected) */
+    gpointer current_start_note; /**< \brief Last start note printed (see ext_notes.c) */
+    GHashTable *pair_counts;    /**< \brief Cell pairs this interpreter executed (see record_cell_pair) */
+} KitVM;
+
+
 
 #include "globals.h"
+#include "vm.h"
+#include "server.h"
+#include "batch.h"
+#include "parallel.h"
+#include "alloc.h"
 #include "param.h"
 #include "entry.h"
 #include "dictionary.h"
 #include "stack.h"
 #include "return_stack.h"
 #include "ec_basic.h"
+#include "ec_math.h"
+#include "string_cache.h"
+#include "optimize.h"
+#include "stack_effect.h"
+#include "specialize.h"
 #include "ext_notes.h"
 #include "ext_sequence.h"
 #include "ext_sqlite.h"
@@ -0,0 +1,357 @@
+/** \file alloc.c
+
+\brief A slab allocator with size-class free lists for small objects.
+
+Params (and the payloads of custom Params like Tasks and Notes) are allocated
+and freed at a high rate, especially by sequence words that copy every element.
+Rather than going through g_malloc and g_free each time, requests are rounded up
+to a multiple of ALLOC_GRANULE and served from a free list for that size class.
+When a free list runs dry, a new slab is carved into cells for it.
+
+Requests larger than ALLOC_MAX_SIZE go straight to g_malloc.
+
+Each thread has its own free lists (and counters), so allocating and freeing
+usually don't take any locks. Memory may be freed on a different thread than
+the one that allocated it; it just goes onto the freeing thread's free list.
+
+So that cells don't pile up on one thread (e.g., pmap results are allocated on
+workers and freed by the caller), a thread's free list for a size class is
+capped at ALLOC_MAX_FREE_SLABS slabs' worth of cells. Past that, a slab's worth
+is given back to a shared free list, which threads take cells from before
+adding a new slab. Threads also give back all of their free cells when they
+exit. Only the shared free lists and adding a slab take a lock.
+
+Slabs are only given back when the allocator is destroyed, so everything
+allocated here must be freed with slab_free (never g_free) and must not be used
+after destroy_allocator.
+
+When built with KIT_DEBUG_ALLOC (configure with --enable-debug-alloc), freed cells
+are filled with ALLOC_POISON and checked when they are handed out again. This
+catches writes to memory that has already been freed.
+*/
+
+#define ALLOC_GRANULE     16        /**< \brief Size classes are multiples of this */
+#define ALLOC_MAX_SIZE    512       /**< \brief Largest request served from a slab */
+#define ALLOC_SLAB_SIZE   16384     /**< \brief Bytes per slab */
+#define ALLOC_POISON      0xdb      /**< \brief Fill byte for freed cells in debug mode */
+#define ALLOC_MAX_FREE_SLABS 2      /**< \brief Free cells a thread keeps per size class (in slabs) */
+
+#define ALLOC_NUM_CLASSES (ALLOC_MAX_SIZE / ALLOC_GRANULE)
+#define SIZE_CLASS(_size_) (((_size_) - 1) / ALLOC_GRANULE)
+
+
+/** \brief A free cell links to the next free cell of its size class
+*/
+typedef struct FreeCell {
+    struct FreeCell *next;
+} FreeCell;
+
+
+/** \brief Free list and counters for one size class
+*/
+typedef struct {
+    FreeCell *free_list;
+    guint num_free;             /**< \brief Cells on free_list */
+    guint64 num_allocs;
+    guint64 num_frees;
+    guint num_slabs;
+} SizeClass;
+
+
+static __thread SizeClass _size_classes[ALLOC_NUM_CLASSES];
+static __thread guint64 _num_large_allocs = 0;
+static __thread guint64 _num_large_frees = 0;
+
+/** \brief Cells given back by threads, for any thread to use
+*/
+typedef struct {
+    FreeCell *free_list;
+    guint num_free;             /**< \brief Cells on free_list */
+} SharedClass;
+
+
+static GPtrArray *_slabs = NULL;    /**< \brief Slabs of all threads (guarded by the slabs lock) */
+static SharedClass _shared_classes[ALLOC_NUM_CLASSES];  /**< \brief Guarded by the slabs lock */
+G_LOCK_DEFINE_STATIC(slabs);
+
+static void give_back_thread_cells(gpointer gp_unused);
+static GPrivate _thread_cells = G_PRIVATE_INIT(give_back_thread_cells);  /**< \brief Set once a thread has free lists */
+
+
+
+// -----------------------------------------------------------------------------
+/** Sets up the allocator. This must be called before any Params are created.
+*/
+// -----------------------------------------------------------------------------
+void create_allocator() {
+    memset(_size_classes, 0, sizeof(_size_classes));
+    memset(_shared_classes, 0, sizeof(_shared_classes));
+    _slabs = g_ptr_array_new_with_free_func(g_free);
+    _num_large_allocs = 0;
+    _num_large_frees = 0;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Frees all slabs. Anything still allocated from them becomes invalid.
+
+This must only be called once no other threads are using the allocator.
+*/
+// -----------------------------------------------------------------------------
+void destroy_allocator() {
+    g_ptr_array_free(_slabs, TRUE);
+    _slabs = NULL;
+    memset(_size_classes, 0, sizeof(_size_classes));
+    memset(_shared_classes, 0, sizeof(_shared_classes));
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns the number of cells in a slab of a size class
+*/
+// -----------------------------------------------------------------------------
+static guint get_cells_per_slab(guint class_index) {
+    return ALLOC_SLAB_SIZE / ((class_index + 1) * ALLOC_GRANULE);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Moves cells from the front of the thread's free list to the shared one
+*/
+// -----------------------------------------------------------------------------
+static void give_back_cells(guint class_index, guint num_cells) {
+    SizeClass *size_class = &_size_classes[class_index];
+    FreeCell *first = size_class->free_list;
+    FreeCell *last = first;
+    for (guint i=1; i < num_cells; i++) {
+        last = last->next;
+    }
+    size_class->free_list = last->next;
+    size_class->num_free -= num_cells;
+
+    SharedClass *shared_class = &_shared_classes[class_index];
+    G_LOCK(slabs);
+    last->next = shared_class->free_list;
+    shared_class->free_list = first;
+    shared_class->num_free += num_cells;
+    G_UNLOCK(slabs);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Gives back all of a thread's free cells when it exits
+*/
+// -----------------------------------------------------------------------------
+static void give_back_thread_cells(gpointer gp_unused) {
+    if (!_slabs) return;   // The allocator is already gone
+
+    for (guint i=0; i < ALLOC_NUM_CLASSES; i++) {
+        if (_size_classes[i].num_free > 0) {
+            give_back_cells(i, _size_classes[i].num_free);
+        }
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Moves up to a slab's worth of shared cells onto the thread's (empty) free
+    list.
+
+\returns FALSE if there are no shared cells
+*/
+// -----------------------------------------------------------------------------
+static gboolean take_shared_cells(guint class_index) {
+    SharedClass *shared_class = &_shared_classes[class_index];
+    SizeClass *size_class = &_size_classes[class_index];
+
+    G_LOCK(slabs);
+    FreeCell *first = shared_class->free_list;
+    if (!first) {
+        G_UNLOCK(slabs);
+        return FALSE;
+    }
+
+    guint num_cells = MIN(shared_class->num_free, get_cells_per_slab(class_index));
+    FreeCell *last = first;
+    for (guint i=1; i < num_cells; i++) {
+        last = last->next;
+    }
+    shared_class->free_list = last->next;
+    shared_class->num_free -= num_cells;
+    G_UNLOCK(slabs);
+
+    last->next = size_class->free_list;
+    size_class->free_list = first;
+    size_class->num_free += num_cells;
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Carves a new slab into cells and adds them to a size class's free list
+*/
+// -----------------------------------------------------------------------------
+static void add_slab(guint class_index) {
+    gsize cell_size = (class_index + 1) * ALLOC_GRANULE;
+    guint num_cells = get_cells_per_slab(class_index);
+
+    gchar *slab = g_malloc(num_cells * cell_size);
+    G_LOCK(slabs);
+    g_ptr_array_add(_slabs, slab);
+    G_UNLOCK(slabs);
+
+    SizeClass *size_class = &_size_classes[class_index];
+    for (guint i = num_cells; i > 0; i--) {
+        FreeCell *cell = (FreeCell *) (slab + (i-1) * cell_size);
+#ifdef KIT_DEBUG_ALLOC
+        memset(cell, ALLOC_POISON, cell_size);
+#endif
+        cell->next = size_class->free_list;
+        size_class->free_list = cell;
+    }
+    size_class->num_free += num_cells;
+    size_class->num_slabs++;
+}
+
+
+
+#ifdef KIT_DEBUG_ALLOC
+// -----------------------------------------------------------------------------
+/** Checks that a free cell hasn't been written to since it was freed
+*/
+// -----------------------------------------------------------------------------
+static void check_poison(FreeCell *cell, gsize cell_size) {
+    const guchar *bytes = (const guchar *) cell;
+    for (gsize i = sizeof(FreeCell); i < cell_size; i++) {
+        if (bytes[i] != ALLOC_POISON) {
+            fprintf(stderr, "Allocator: freed %ld-byte cell %p was modified at offset %ld\n",
+                    (gint64) cell_size, (gpointer) cell, (gint64) i);
+            abort();
+        }
+    }
+}
+#endif
+
+
+
+// -----------------------------------------------------------------------------
+/** Allocates memory for an object of the specified size.
+
+\note Memory from this function must be freed with slab_free using the same size.
+*/
+// -----------------------------------------------------------------------------
+gpointer slab_alloc(gsize size) {
+    if (size == 0) size = 1;
+
+    if (size > ALLOC_MAX_SIZE) {
+        _num_large_allocs++;
+        return g_malloc(size);
+    }
+
+    guint class_index = SIZE_CLASS(size);
+    SizeClass *size_class = &_size_classes[class_index];
+    if (!size_class->free_list) {
+        // Make sure the thread's free cells are given back when it exits
+        if (!g_private_get(&_thread_cells)) {
+            g_private_set(&_thread_cells, GINT_TO_POINTER(1));
+        }
+        if (!take_shared_cells(class_index)) {
+            add_slab(class_index);
+        }
+    }
+
+    FreeCell *result = size_class->free_list;
+    size_class->free_list = result->next;
+    size_class->num_free--;
+    size_class->num_allocs++;
+
+#ifdef KIT_DEBUG_ALLOC
+    check_poison(result, (class_index + 1) * ALLOC_GRANULE);
+#endif
+
+    return result;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Allocates zero-filled memory for an object of the specified size.
+*/
+// -----------------------------------------------------------------------------
+gpointer slab_alloc0(gsize size) {
+    gpointer result = slab_alloc(size);
+    memset(result, 0, size);
+    return result;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns memory from slab_alloc to its size class's free list.
+
+\param mem: Memory to free (may be NULL)
+\param size: Size that was passed to slab_alloc
+*/
+// -----------------------------------------------------------------------------
+void slab_free(gpointer mem, gsize size) {
+    if (!mem) return;
+    if (size == 0) size = 1;
+
+    if (size > ALLOC_MAX_SIZE) {
+        _num_large_frees++;
+        g_free(mem);
+        return;
+    }
+
+    guint class_index = SIZE_CLASS(size);
+    SizeClass *size_class = &_size_classes[class_index];
+    FreeCell *cell = mem;
+
+#ifdef KIT_DEBUG_ALLOC
+    memset(cell, ALLOC_POISON, (class_index + 1) * ALLOC_GRANULE);
+#endif
+
+    cell->next = size_class->free_list;
+    size_class->free_list = cell;
+    size_class->num_free++;
+    size_class->num_frees++;
+
+    guint cells_per_slab = get_cells_per_slab(class_index);
+    if (size_class->num_free > ALLOC_MAX_FREE_SLABS * cells_per_slab) {
+        give_back_cells(class_index, cells_per_slab);
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Prints allocation counts for each size class that the calling thread has used
+*/
+// -----------------------------------------------------------------------------
+void print_alloc_stats(FILE *file) {
+    fprintf(file, "%6s %12s %12s %10s %6s\n", "size", "allocs", "frees", "live", "slabs");
+
+    for (guint i=0; i < ALLOC_NUM_CLASSES; i++) {
+        SizeClass *size_class = &_size_classes[i];
+        if (size_class->num_slabs == 0) continue;
+
+        fprintf(file, "%6d %12ld %12ld %10ld %6d\n",
+                (i + 1) * ALLOC_GRANULE,
+                size_class->num_allocs,
+                size_class->num_frees,
+                size_class->num_allocs - size_class->num_frees,
+                size_class->num_slabs);
+    }
+
+    fprintf(file, "%6s %12ld %12ld %10ld %6s\n", "large",
+            _num_large_allocs,
+            _num_large_frees,
+            _num_large_allocs - _num_large_frees,
+            "-");
+}
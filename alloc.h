@@ -0,0 +1,17 @@
+/** \file alloc.h
+*/
+
+#pragma once
+
+void create_allocator();
+void destroy_allocator();
+
+gpointer slab_alloc(gsize size);
+gpointer slab_alloc0(gsize size);
+void slab_free(gpointer mem, gsize size);
+
+void print_alloc_stats(FILE *file);
+
+#define slab_new(_type_) ((_type_ *) slab_alloc(sizeof(_type_)))
+#define slab_new0(_type_) ((_type_ *) slab_alloc0(sizeof(_type_)))
+#define slab_delete(_type_, _mem_) slab_free((_mem_), sizeof(_type_))
@@ -0,0 +1,125 @@
+/** \file batch.c
+
+\brief Runs many scripts at once on a pool of threads.
+
+In batch mode (kit --batch [-j N] script...), each script runs in its own
+interpreter (see create_vm) on one of N worker threads. The interpreters share
+the basic dictionary and the custom types, which are set up once for the whole
+batch. Lexicons a script loads go into its own dictionary.
+
+Each script's output and errors go into its own in-memory buffer. The buffers
+are written to stdout in the order the scripts were given, each one as soon as
+its script and all of the scripts before it are done, so the output doesn't
+depend on how the threads were scheduled.
+
+Scripts shouldn't read stdin (e.g., with ".i"), since they would all be
+reading it at once. Since the scripts share a process, a script that crashes
+takes the whole batch down with it.
+*/
+
+/** \brief A script to run and what it printed
+*/
+typedef struct {
+    const gchar *path;          /**< \brief Script file */
+    gchar *output;              /**< \brief Everything the script printed (free with free) */
+    gsize output_len;           /**< \brief Bytes in output */
+    gboolean failed;            /**< \brief TRUE if the script couldn't be opened or its output buffered */
+    gboolean done;              /**< \brief Set once output is complete */
+} BatchJob;
+
+
+/** \brief Scripts being run and how the workers report that they're done
+*/
+typedef struct {
+    BatchJob *jobs;
+    GMutex lock;                /**< \brief Guards the done flags of the jobs */
+    GCond job_done;             /**< \brief Signaled when a job is done */
+} Batch;
+
+
+
+// -----------------------------------------------------------------------------
+/** Runs one script in a new interpreter on a worker thread.
+*/
+// -----------------------------------------------------------------------------
+static void run_batch_job(gpointer gp_job, gpointer gp_batch) {
+    BatchJob *job = gp_job;
+    Batch *batch = gp_batch;
+
+    FILE *file_output = open_memstream(&job->output, &job->output_len);
+    FILE *input_file = file_output ? fopen(job->path, "r") : NULL;
+    job->failed = input_file == NULL;
+
+    if (!file_output) {
+        fprintf(stderr, "Unable to buffer the output of: %s\n", job->path);
+    }
+    else if (!input_file) {
+        fprintf(file_output, "Unable to open file: %s\n", job->path);
+    }
+    else {
+        KitVM *vm = create_vm();
+        vm->out = file_output;
+        vm->err = file_output;
+
+        KitVM *vm_prev = use_vm(vm);
+        scan_file(input_file);
+        run_vm();
+        use_vm(vm_prev);
+
+        destroy_vm(vm);
+        fclose(input_file);
+    }
+    if (file_output) fclose(file_output);
+
+    g_mutex_lock(&batch->lock);
+    job->done = TRUE;
+    g_cond_broadcast(&batch->job_done);
+    g_mutex_unlock(&batch->lock);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Runs scripts concurrently, writing their output to stdout in order.
+
+The basic dictionary and custom types must already be set up.
+
+\param num_threads: Number of worker threads
+\returns 0, or 1 if any script couldn't be opened (or its output buffered)
+*/
+// -----------------------------------------------------------------------------
+int run_batch(gint num_threads, gchar **paths, gint num_paths) {
+    Batch batch;
+    batch.jobs = g_new0(BatchJob, num_paths);
+    g_mutex_init(&batch.lock);
+    g_cond_init(&batch.job_done);
+
+    GThreadPool *pool = g_thread_pool_new(run_batch_job, &batch, num_threads, TRUE, NULL);
+    for (gint i=0; i < num_paths; i++) {
+        batch.jobs[i].path = paths[i];
+        g_thread_pool_push(pool, &batch.jobs[i], NULL);
+    }
+
+    // Write each script's output once it and the ones before it are done
+    gint result = 0;
+    for (gint i=0; i < num_paths; i++) {
+        BatchJob *job = &batch.jobs[i];
+
+        g_mutex_lock(&batch.lock);
+        while (!job->done) {
+            g_cond_wait(&batch.job_done, &batch.lock);
+        }
+        g_mutex_unlock(&batch.lock);
+
+        fwrite(job->output, 1, job->output_len, stdout);
+        fflush(stdout);
+        free(job->output);
+        if (job->failed) result = 1;
+    }
+
+    g_thread_pool_free(pool, FALSE, TRUE);
+    g_cond_clear(&batch.job_done);
+    g_mutex_clear(&batch.lock);
+    g_free(batch.jobs);
+    return result;
+}
@@ -0,0 +1,6 @@
+/** \file batch.h
+*/
+
+#pragma once
+
+int run_batch(gint num_threads, gchar **paths, gint num_paths);
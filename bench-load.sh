@@ -0,0 +1,23 @@
+#!/bin/sh
+## \file bench-load.sh
+#
+# Generates a large Forth script for timing how fast kit loads source. Most
+# lines push and pop literals; every tenth line defines a word.
+#
+#   ./bench-load.sh 300000 > /tmp/bench-load.forth
+#   time ./kit /tmp/bench-load.forth
+#
+
+NUM_LINES=${1:-300000}
+
+awk -v num_lines="$NUM_LINES" 'BEGIN {
+    for (i = 1; i <= num_lines; i++) {
+        if (i % 10 == 0) {
+            printf(": w%d   %d 2.5 \"a string literal\" pop pop pop ;\n", i, i);
+        }
+        else {
+            printf("%d 1.25 \"a string that is longer than the inline buffer %d\" pop pop pop\n", i, i);
+        }
+    }
+    print ".q";
+}'
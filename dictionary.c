@@ -1,32 +1,135 @@
 /** \file dictionary.c
 
-\brief Defines functions for manipulating the global Forth dictionary: _dictionary.
+\brief Defines functions for manipulating Forth dictionaries.
 
-A Dictionary is just a GList of Entry objects. Each Entry is added to the end
-of the _dictionary. Searches for an Entry start at the end and move backwards.
-This allows older entries to be overridden.
+A Dictionary is a GList of Entry objects. Each Entry is added to the end of
+its dictionary. Lookups go through the dictionary's index, which maps each word
+to the chain of its entries, newest first. This allows older entries to be
+overridden while still being found if a newer definition is incomplete.
 
 The basic dictionary is built using build_dictionary. This should be functional
 as a control language. Any extensions to the dictionary should be done via
 a word that can load new entries.
 
+The basic dictionary is shared by every interpreter (see vm.c) and isn't
+changed once it's built. Words an interpreter defines (including those added
+by loading a lexicon) go into its own dictionary, which is searched first.
+
+*/
+
+
+static Dictionary *_base_dictionary = NULL;   /**< \brief Builtin words shared by all interpreters */
+
+
+// -----------------------------------------------------------------------------
+/** Frees the chain of entries for a word in the index.
+
+The entries themselves are owned by the dictionary's list of entries.
+*/
+// -----------------------------------------------------------------------------
+static void free_index_chain(gpointer gp_chain) {
+    g_slist_free(gp_chain);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns the dictionary that new entries go into.
+
+This is the running interpreter's dictionary or, while the basic dictionary is
+being built, the basic dictionary.
+*/
+// -----------------------------------------------------------------------------
+static Dictionary *target_dictionary() {
+    return _vm ? _vm->dictionary : _base_dictionary;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Creates an empty dictionary.
+
+\param parent: Where words that aren't defined in the new dictionary are looked up
+*/
+// -----------------------------------------------------------------------------
+Dictionary *new_dictionary(const Dictionary *parent) {
+    Dictionary *result = g_new0(Dictionary, 1);
+    result->index = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_index_chain);
+    result->parent = parent;
+    return result;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Frees a dictionary and all of its entries (but not its parent).
+*/
+// -----------------------------------------------------------------------------
+void free_dictionary(Dictionary *dictionary) {
+    g_hash_table_destroy(dictionary->index);
+    g_list_free_full(dictionary->entries, free_entry);
+    g_slist_free_full(dictionary->anonymous_entries, free_entry);
+    g_free(dictionary);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns the basic dictionary (NULL until build_dictionary is called)
+*/
+// -----------------------------------------------------------------------------
+const Dictionary *get_base_dictionary() {
+    return _base_dictionary;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Searches a dictionary and its parents for the most recent complete entry for
+    a word.
+
+The shadow chain for the word is walked newest first so that an entry still
+being defined (complete == 0) falls back to the previous definition.
 */
+// -----------------------------------------------------------------------------
+static Entry *find_entry_from(const Dictionary *dictionary, const gchar *word) {
+    for (; dictionary; dictionary = dictionary->parent) {
+        GSList *chain = g_hash_table_lookup(dictionary->index, word);
+        for (GSList *l = chain; l != NULL; l = l->next) {
+            Entry *entry = l->data;
+            if (entry->complete) return entry;
+        }
+    }
+    return NULL;
+}
+
 
 
 // -----------------------------------------------------------------------------
-/** Searches for an entry in the dictionary, starting from the most recent entry
-and moving backwards.
+/** Searches for the most recent complete entry for a word.
+
+Words that aren't found in the interpreter's dictionary are looked up in its
+parents.
 
 \param word: The string to search for
 \returns A pointer to the entry or NULL if not found
 */
 // -----------------------------------------------------------------------------
 Entry* find_entry(const gchar* word) {
-    for (GList* l=g_list_last(_dictionary); l != NULL; l = l->prev) {
-        Entry *entry = l->data;
-        if (entry->complete && g_strcmp0(word, entry->word) == 0) return entry;
-    }
-    return NULL;
+    return find_entry_from(target_dictionary(), word);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Searches the basic dictionary only, skipping any words that interpreters
+    have redefined.
+
+\returns A pointer to the entry or NULL if not found
+*/
+// -----------------------------------------------------------------------------
+Entry *find_base_entry(const gchar *word) {
+    return find_entry_from(_base_dictionary, word);
 }
 
 
@@ -38,13 +141,95 @@ Entry* find_entry(const gchar* word) {
 */
 // -----------------------------------------------------------------------------
 Entry *add_entry(const gchar *word) {
+    Dictionary *dictionary = target_dictionary();
     Entry *result = new_entry();
+    result->dictionary = dictionary;
     g_strlcpy(result->word, word, MAX_WORD_LEN);
-    _dictionary = g_list_append(_dictionary, result);
+
+    // Append in O(1) by appending to the tail link
+    if (!dictionary->entries) {
+        dictionary->entries = g_list_append(NULL, result);
+        dictionary->tail = dictionary->entries;
+    }
+    else {
+        g_list_append(dictionary->tail, result);
+        dictionary->tail = dictionary->tail->next;
+    }
+
+    // Shadow any older entries for this word. The chain is stolen (not freed)
+    // so it can be re-inserted under the new entry's word.
+    GSList *chain = g_hash_table_lookup(dictionary->index, result->word);
+    g_hash_table_steal(dictionary->index, result->word);
+    g_hash_table_insert(dictionary->index, result->word, g_slist_prepend(chain, result));
+
+    dictionary->generation++;
+    return result;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Adds an entry that can't be looked up by word (e.g., for a quotation).
+
+The entry is owned by the dictionary and is freed along with it.
+*/
+// -----------------------------------------------------------------------------
+Entry *add_anonymous_entry() {
+    Dictionary *dictionary = target_dictionary();
+    Entry *result = new_entry();
+    result->dictionary = dictionary;
+    dictionary->anonymous_entries = g_slist_prepend(dictionary->anonymous_entries, result);
     return result;
 }
 
 
+
+// -----------------------------------------------------------------------------
+/** Checks whether one entry can keep a reference to another.
+
+A child interpreter's dictionary is freed before its parent's, so an entry
+(e.g., a variable) mustn't refer to an entry defined in a descendant of its
+dictionary (e.g., a quotation made in a server session).
+
+\returns FALSE if entry_to may be freed before entry_from
+*/
+// -----------------------------------------------------------------------------
+gboolean may_refer_to(const Entry *entry_from, const Entry *entry_to) {
+    if (!entry_to->dictionary || entry_to->dictionary == entry_from->dictionary) return TRUE;
+
+    for (const Dictionary *dictionary = entry_to->dictionary->parent; dictionary;
+         dictionary = dictionary->parent) {
+        if (dictionary == entry_from->dictionary) return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Marks an entry as completely defined so find_entry will return it.
+*/
+// -----------------------------------------------------------------------------
+void complete_entry(Entry *entry) {
+    entry->complete = 1;
+    target_dictionary()->generation++;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns a number that changes whenever an entry is added or completed.
+
+Anything that caches the results of find_entry (e.g., compiled strings) is
+stale once this changes. Since parents don't change while their children are
+in use, only the interpreter's own dictionary is considered.
+*/
+// -----------------------------------------------------------------------------
+guint get_dictionary_generation() {
+    return target_dictionary()->generation;
+}
+
+
 // -----------------------------------------------------------------------------
 /** Adds words to add various lexicons to the dictionary.
 
@@ -62,39 +247,53 @@ static void hook_up_extensions() {
 
 
 // -----------------------------------------------------------------------------
-/** Builds the dictionary for the interpreter.
+/** Builds the basic dictionary shared by all interpreters.
 
 This defines the basic words for the interpreter and will allow loading
 of custom extensions for various applications. This is TBD, but the intent is
 that we can control the extensions dynamically.
 
-\note Entries are new'd and so it's appropriate to do a g_list_free_full
-      if the dictionary should be rebuilt.
+This must be called before any interpreters are created (see create_vm).
 */
 // -----------------------------------------------------------------------------
 void build_dictionary() {
+    KitVM *vm_prev = use_vm(NULL);
+    _base_dictionary = new_dictionary(NULL);
+
     add_basic_words();
     hook_up_extensions();
+
+    use_vm(vm_prev);
 }
 
 
 // -----------------------------------------------------------------------------
-/** Returns the most recently added entry in the dictionary.
+/** Returns the most recently added entry in the interpreter's dictionary.
 
 During compilation of a definition, that definition will be the
 latest entry.
+
+\returns NULL if nothing has been defined in the interpreter's dictionary
 */
 // -----------------------------------------------------------------------------
 Entry *latest_entry() {
-    Entry *result = g_list_last(_dictionary)->data;
+    GList *tail = target_dictionary()->tail;
+    if (!tail) return NULL;
+
+    Entry *result = tail->data;
     return result;
 }
 
 
 // -----------------------------------------------------------------------------
-/** Deallocates dictionary and all of its entries.
+/** Deallocates the basic dictionary and all of its entries.
+
+This must be called after all interpreters are destroyed.
 */
 // -----------------------------------------------------------------------------
 void destroy_dictionary() {
-    g_list_free_full(_dictionary, free_entry);
+    if (!_base_dictionary) return;
+
+    free_dictionary(_base_dictionary);
+    _base_dictionary = NULL;
 }
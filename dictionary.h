@@ -4,7 +4,15 @@
 #pragma once
 
 void build_dictionary();
+Dictionary *new_dictionary(const Dictionary *parent);
+void free_dictionary(Dictionary *dictionary);
+const Dictionary *get_base_dictionary();
 Entry *add_entry(const gchar *word);
 Entry* find_entry(const gchar* word);
+Entry *find_base_entry(const gchar *word);
 Entry *latest_entry();
+Entry *add_anonymous_entry();
+gboolean may_refer_to(const Entry *entry_from, const Entry *entry_to);
+void complete_entry(Entry *entry);
+guint get_dictionary_generation();
 void destroy_dictionary();
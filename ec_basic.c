@@ -7,11 +7,33 @@ routines used when defining entries dynamically.
 
 */
 
+/** \brief Control words that open (or continue) a block that a later word closes
+*/
+typedef enum {
+    CONTROL_IF,                 /**< \brief Index of the jmp cell of "if" */
+    CONTROL_ELSE,               /**< \brief Index of the jmp cell of "else" */
+    CONTROL_DO,                 /**< \brief Index of the OP_DO cell of "do" */
+    CONTROL_BEGIN,              /**< \brief Index of the cell after "begin" */
+    CONTROL_WHILE,              /**< \brief Index of the jmp cell of "while" */
+} ControlKind;
+
+
+/** \brief The index of a cell that a control word left for a later one to resolve
+*/
+typedef struct {
+    Entry *entry;               /**< \brief Entry the cell is in */
+    gint64 index;               /**< \brief Index of the cell in the entry's code */
+    ControlKind kind;           /**< \brief Control word that left the index */
+} ControlFrame;
+
+
+/** \brief A quotation that is being compiled
+*/
+typedef struct {
+    Entry *entry;               /**< \brief Anonymous entry for the quotation's code */
+    gchar saved_mode;           /**< \brief Mode to return to at the end of the quotation */
+} QuotationFrame;
 
-static void EC_execute(gpointer gp_entry);
-static void EC_jmp(gpointer gp_entry);
-static void EC_jmp_if_false(gpointer gp_entry);
-static void EC_push_entry_address(gpointer gp_entry);
 
 
 // -----------------------------------------------------------------------------
@@ -19,7 +41,7 @@ static void EC_push_entry_address(gpointer gp_entry);
 */
 // -----------------------------------------------------------------------------
 void add_variable(const gchar *word) {
-    Entry *entry_new = add_entry(word);
+    Entry *entry_new = declare_effect(add_entry(word), 0, 1);
     entry_new->routine = EC_push_entry_address;
 
     // Adds an empty param to the variable entry for storing values
@@ -30,11 +52,11 @@ void add_variable(const gchar *word) {
 
 
 // -----------------------------------------------------------------------------
-/** Sets the _quit flag so the main control loop stops.
+/** Sets the _vm->quit flag so the main control loop stops.
 */
 // -----------------------------------------------------------------------------
 static void EC_quit(gpointer gp_entry) {
-    _quit = 1;
+    _vm->quit = 1;
 }
 
 
@@ -74,7 +96,7 @@ static void EC_constant(gpointer gp_entry) {
 
     // NOTE: When we add the popped param to the entry, its memory is
     //       managed by that entry, so we don't need to free it here.
-    Entry *entry_new = add_entry(param_str->val_string);
+    Entry *entry_new = declare_effect(add_entry(param_str->val_string), 0, 1);
     entry_new->routine = EC_push_param0;
     add_entry_param(entry_new, param0);
 
@@ -112,35 +134,50 @@ static void EC_variable(gpointer gp_entry) {
 */
 // -----------------------------------------------------------------------------
 static void EC_store_variable_value(gpointer gp_entry) {
-    Param *p_var = pop_param();    // Variable to store value in
-    if (!p_var) {
+    StackCell *cell_var = stack_cell(0);    // Variable to store value in
+    if (!cell_var || !stack_cell(1)) {
         handle_error(ERR_STACK_UNDERFLOW);
         return;
     }
 
-    Param *p_value = pop_param();  // Value to store
-    if (!p_value) {
-        handle_error(ERR_STACK_UNDERFLOW);
+    if (cell_var->type != 'E') {
+        Param *p_var = pop_param();
+        handle_error(ERR_INVALID_PARAM);
+        fprintf(_vm->err, "----> ");
+        print_param(_vm->err, p_var);
+        free_param(p_var);
         return;
     }
+    Entry *entry_var = cell_var->val_entry;
+    drop_cells(1);
+
+    Param *p_value = pop_param();  // Value to store
 
-    if (p_var->type != 'E') {
+    // Other threads may be reading shared variables (see run_chunks)
+    if (_vm->read_only_vars && entry_var->dictionary != _vm->dictionary) {
         handle_error(ERR_INVALID_PARAM);
-        fprintf(stderr, "----> ");
-        print_param(stderr, p_var);
+        fprintf(_vm->err, "-----> Can't store in a shared variable from a parallel block: %s\n",
+                entry_var->word);
+        free_param(p_value);
         return;
     }
 
+    // Words defined in a child interpreter go away with it
+    if ((p_value->type == 'E' || p_value->type == 'Q') && !may_refer_to(entry_var, p_value->val_entry)) {
+        handle_error(ERR_INVALID_PARAM);
+        fprintf(_vm->err, "-----> Can't store a word defined here in an outer interpreter's variable: %s\n",
+                entry_var->word);
+        free_param(p_value);
+        return;
+    }
 
     // Store value in variable
-    Entry *entry_var = p_var->val_entry;
     GSequenceIter *iter = g_sequence_get_iter_at_pos(entry_var->params, 0);
     Param *var_value = g_sequence_get(iter);
     copy_param(var_value, p_value);
 
     // Cleanup
     free_param(p_value);
-    free_param(p_var);
 }
 
 
@@ -151,18 +188,19 @@ static void EC_store_variable_value(gpointer gp_entry) {
 \param gp_entry: unused
 */
 // -----------------------------------------------------------------------------
-static void EC_fetch_variable_value(gpointer gp_entry) {
-    Param *p_var = pop_param();
+void EC_fetch_variable_value(gpointer gp_entry) {
+    StackCell *cell_var = stack_cell(0);
+    if (!cell_var) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        return;
+    }
+
+    Entry *entry_var = cell_var->val_entry;
+    drop_cells(1);
 
-    Entry *entry_var = p_var->val_entry;
     GSequenceIter *iter = g_sequence_get_iter_at_pos(entry_var->params, 0);
     Param *var_value = g_sequence_get(iter);
-
-    COPY_PARAM(param_new, var_value);
-    push_param(param_new);
-
-    // Cleanup
-    free_param(p_var);
+    push_param_copy(var_value);
 }
 
 
@@ -178,8 +216,7 @@ void EC_push_param0(gpointer gp_entry) {
     GSequenceIter *begin = g_sequence_get_begin_iter(entry->params);
     Param *param0 = g_sequence_get(begin);
 
-    COPY_PARAM(param_new, param0);
-    push_param(param_new);
+    push_param_copy(param0);
 }
 
 
@@ -190,32 +227,30 @@ void EC_push_param0(gpointer gp_entry) {
 \param gp_entry: The entry with the parameter to be pushed.
 */
 // -----------------------------------------------------------------------------
-static void EC_push_entry_address(gpointer gp_entry) {
+void EC_push_entry_address(gpointer gp_entry) {
     Entry *entry = gp_entry;
-    Param *param = new_entry_param(entry);
-    push_param(param);
+    push_entry(entry);
 }
 
 
 
-static void gfunc_print_param(gpointer gp_param, gpointer user_data) {
-    Param *param = gp_param;
-    printf("%c: ", param->type);
+static void print_stack_param(const Param *param) {
+    fprintf(_vm->out, "%c: ", param->type);
     switch(param->type) {
         case 'I':
-            printf("%ld\n", param->val_int);
+            fprintf(_vm->out, "%ld\n", param->val_int);
             break;
 
         case 'D':
-            printf("%lf\n", param->val_double);
+            fprintf(_vm->out, "%lf\n", param->val_double);
             break;
 
         case 'S':
-            printf("\"%s\"\n", param->val_string);
+            fprintf(_vm->out, "\"%s\"\n", param->val_string);
             break;
 
         case 'C':
-            printf("%s\n", param->val_custom_type);
+            fprintf(_vm->out, "%s\n", param->val_custom_type->name);
             break;
 
         default:
@@ -231,9 +266,96 @@ static void gfunc_print_param(gpointer gp_param, gpointer user_data) {
 */
 // -----------------------------------------------------------------------------
 static void EC_print_stack(gpointer gp_entry) {
-    // NOTE: We're assuming that this goes from the first element to the last
-    g_queue_foreach(_stack, gfunc_print_param, NULL);
-    printf("--\n");
+    Param scratch;
+    for (guint i=get_stack_depth(); i > 0; i--) {
+        print_stack_param(cell_param(stack_cell(i-1), &scratch));
+    }
+    fprintf(_vm->out, "--\n");
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Prints allocator statistics for each size class.
+
+*/
+// -----------------------------------------------------------------------------
+static void EC_print_memory_stats(gpointer gp_entry) {
+    print_alloc_stats(_vm->out);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Prints string cache counters.
+*/
+// -----------------------------------------------------------------------------
+static void EC_print_cache_stats(gpointer gp_entry) {
+    print_string_cache_stats(_vm->out);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Prints the most frequently executed pairs of cells (see optimize.c).
+*/
+// -----------------------------------------------------------------------------
+static void EC_print_pairs(gpointer gp_entry) {
+    print_pair_profile(_vm->out);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Checks that a compiling word is being used in a definition (or quotation).
+
+\param gp_entry: Entry for the compiling word (used for the error message)
+\returns FALSE if not compiling (the error is handled here)
+*/
+// -----------------------------------------------------------------------------
+static gboolean check_compiling(gpointer gp_entry) {
+    Entry *entry = gp_entry;
+    if (_vm->mode != 'C') {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> '%s' can only be used in a definition\n", entry->word);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Abandons the indexes left by control words (e.g., after an error).
+*/
+// -----------------------------------------------------------------------------
+void clear_control_frames() {
+    g_slist_free_full(_vm->control_frames, g_free);
+    _vm->control_frames = NULL;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Checks that no control word left an index in an entry that is being finished.
+
+\param entry: The definition or quotation being finished
+\returns FALSE if a block wasn't closed (the error is handled here)
+*/
+// -----------------------------------------------------------------------------
+static gboolean check_blocks_closed(const Entry *entry) {
+    static const gchar *openers[] = {"if", "else", "do", "begin", "while"};
+
+    for (GSList *link = _vm->control_frames; link; link = link->next) {
+        ControlFrame *frame = link->data;
+        if (frame->entry != entry) continue;
+
+        const gchar *opener = openers[frame->kind];
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> '%s' wasn't closed in '%s'\n", opener, entry->word);
+        return FALSE;
+    }
+    return TRUE;
 }
 
 
@@ -244,22 +366,22 @@ static void EC_print_stack(gpointer gp_entry) {
 \param gp_entry: The ":" entry
 
 We read the next token, which will be the word for the new definition. Then we
-switch to compile mode so each word we read can be added to the parameters of
+switch to compile mode so each word we read can be compiled into the code of
 the new entry as part of its definition. Different categories of tokens are
 compiled differently:
 
-- Dictionary entries: An "E" parameter is created and added to the new definition.
+- Dictionary entries: An OP_CALL cell is added to the new definition.
                       On execution, the entry is simply executed.
 
-- Literals:           A "P" parameter is created with its first parameter
-                      being the literal. The routine of the "P" parameter
-                      pushes the first param onto the stack.
+- Literals:           An OP_PUSH_LITERAL cell is added that owns the literal.
+                      On execution, a copy of the literal is pushed onto
+                      the stack.
 
 - Immediate words:    These are words like ';' that are executed during a
                       compilation. Macros are an example of an immediate
                       word.
 
-The first parameter is a pointer to the routine for executing a defined word. By
+The routine of the new entry is EC_execute, which runs its compiled cells. By
 allowing this to be dynamically specified, we change the behavior of defined
 words.
 */
@@ -270,33 +392,338 @@ static void EC_define(gpointer gp_entry) {
     Entry *entry_new = add_entry(token.word);
     entry_new->complete = 0;
     entry_new->routine = EC_execute;
+    entry_new->code = g_array_new(FALSE, TRUE, sizeof(Cell));
 
-    _mode = 'C';
+    _vm->mode = 'C';
 }
 
 
 
 // -----------------------------------------------------------------------------
-/** Pops return stack and stores in _ip.
+/** Marks the end of the definition and returns interpreter to 'E'xecute mode.
+
+The definition is optimized, and its stack effect is inferred (see
+stack_effect.c). Definitions whose branches leave different numbers of values
+on the stack still work, but a warning is printed since that's usually a bug.
 */
 // -----------------------------------------------------------------------------
-static void EC_pop_return_stack(gpointer gp_entry) {
-    _ip = pop_param_r();
+static void EC_end_define(gpointer gp_entry) {
+    if (!check_compiling(gp_entry)) return;
+
+    // A quotation outside a definition is compiled in 'C' mode, too
+    Entry *entry_latest = latest_entry();
+    if (!entry_latest || entry_latest->complete) {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> ';' without ':'\n");
+        return;
+    }
+    if (_vm->quotation_frames) {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> '[:' wasn't closed in '%s'\n", entry_latest->word);
+        return;
+    }
+    if (!check_blocks_closed(entry_latest)) return;
+
+    add_entry_cell(entry_latest, OP_RETURN);
+    optimize_entry(entry_latest);
+
+    const gchar *problem = verify_stack_effect(entry_latest);
+    if (problem) {
+        fprintf(_vm->err, "Warning: '%s' is unbalanced\n-----> %s\n", entry_latest->word, problem);
+    }
+    specialize_entry(entry_latest);
+    complete_entry(entry_latest);
+
+    _vm->mode = 'E';
 }
 
 
 
 // -----------------------------------------------------------------------------
-/** Marks the end of the definition and returns interpreter to 'E'xecute mode.
+/** Returns the entry that tokens are being compiled into.
+
+This is the innermost open quotation if there is one; otherwise, it's the
+definition being compiled.
 */
 // -----------------------------------------------------------------------------
-static void EC_end_define(gpointer gp_entry) {
-    Entry *entry_latest = latest_entry();
-    entry_latest->complete = 1;
-    Param *pseudo_param = new_pseudo_entry_param(";", EC_pop_return_stack);
-    add_entry_param(entry_latest, pseudo_param);
+Entry *compiling_entry() {
+    if (_vm->quotation_frames) {
+        QuotationFrame *frame = _vm->quotation_frames->data;
+        return frame->entry;
+    }
+    return latest_entry();
+}
+
 
-    _mode = 'E';
+
+// -----------------------------------------------------------------------------
+/** Abandons any quotations being compiled (e.g., after an error).
+
+Their entries are owned by the dictionary, so only the frames are freed.
+*/
+// -----------------------------------------------------------------------------
+void clear_quotations() {
+    g_slist_free_full(_vm->quotation_frames, g_free);
+    _vm->quotation_frames = NULL;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Compiles tokens into an entry as if it were an open quotation, so that
+    quotations in them are compiled once as literals of the entry.
+
+This is how compiled strings (see string_cache.c) handle "[: ... ;]". Call
+end_compiling_into when the tokens are done.
+*/
+// -----------------------------------------------------------------------------
+void begin_compiling_into(Entry *entry) {
+    QuotationFrame *frame = g_new(QuotationFrame, 1);
+    frame->entry = entry;
+    frame->saved_mode = _vm->mode;
+    _vm->quotation_frames = g_slist_prepend(_vm->quotation_frames, frame);
+
+    _vm->mode = 'C';
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Stops compiling into an entry started with begin_compiling_into.
+
+Quotations that were left open are abandoned (their entries are owned by the
+dictionary).
+
+\returns FALSE if the tokens didn't compile cleanly (a quotation was left open
+         or an error dropped the frames)
+*/
+// -----------------------------------------------------------------------------
+gboolean end_compiling_into(Entry *entry) {
+    gboolean result = TRUE;
+
+    while (_vm->quotation_frames) {
+        QuotationFrame *frame = _vm->quotation_frames->data;
+        _vm->quotation_frames = g_slist_delete_link(_vm->quotation_frames, _vm->quotation_frames);
+
+        gboolean is_entry_frame = frame->entry == entry;
+        _vm->mode = frame->saved_mode;
+        g_free(frame);
+
+        if (is_entry_frame) return result;
+        result = FALSE;
+    }
+
+    // An error cleared the frames (and reset the mode)
+    return FALSE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Starts a quotation: an anonymous block of code that is compiled once and
+    can be passed around as a value.
+
+Until the matching ";]", tokens are compiled into the quotation's entry. This
+works both inside definitions and in execute mode.
+*/
+// -----------------------------------------------------------------------------
+static void EC_start_quotation(gpointer gp_entry) {
+    Entry *entry_new = add_anonymous_entry();
+    g_strlcpy(entry_new->word, "[: ;]", MAX_WORD_LEN);
+    entry_new->routine = EC_execute;
+    entry_new->code = g_array_new(FALSE, TRUE, sizeof(Cell));
+
+    QuotationFrame *frame = g_new(QuotationFrame, 1);
+    frame->entry = entry_new;
+    frame->saved_mode = _vm->mode;
+    _vm->quotation_frames = g_slist_prepend(_vm->quotation_frames, frame);
+
+    _vm->mode = 'C';
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Ends a quotation.
+
+( -- quotation) in execute mode. When the quotation is inside a definition, the
+definition pushes the quotation when it runs.
+*/
+// -----------------------------------------------------------------------------
+static void EC_end_quotation(gpointer gp_entry) {
+    if (!_vm->quotation_frames) {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> ';]' without '[:'\n");
+        return;
+    }
+
+    QuotationFrame *frame = _vm->quotation_frames->data;
+    if (!check_blocks_closed(frame->entry)) return;
+    _vm->quotation_frames = g_slist_delete_link(_vm->quotation_frames, _vm->quotation_frames);
+
+    Entry *entry = frame->entry;
+    add_entry_cell(entry, OP_RETURN);
+    optimize_entry(entry);
+    verify_stack_effect(entry);
+    specialize_entry(entry);
+    _vm->mode = frame->saved_mode;
+    g_free(frame);
+
+    Param *param_quotation = new_quotation_param(entry);
+    if (_vm->mode == 'C') {
+        add_entry_cell(compiling_entry(), OP_PUSH_LITERAL)->literal = param_quotation;
+    }
+    else {
+        push_param(param_quotation);
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if an entry is "[:" or ";]"
+*/
+// -----------------------------------------------------------------------------
+gboolean is_quotation_word(const Entry *entry) {
+    return entry->routine == EC_start_quotation || entry->routine == EC_end_quotation;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Executes a block of code given as a quotation or a Forth string.
+
+Words like map, filter, and sort use this to run their block for each item.
+*/
+// -----------------------------------------------------------------------------
+void execute_block(const Param *param_block) {
+    switch(param_block->type) {
+        case 'Q':
+            execute(param_block->val_entry);
+            break;
+
+        case 'S':
+            execute_string(param_block->val_string);
+            break;
+
+        default:
+            handle_error(ERR_INVALID_PARAM);
+            fprintf(_vm->err, "-----> Expected a quotation or a string, not '%c'\n", param_block->type);
+            break;
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Saves the index of a cell for the control word that closes the block.
+
+The indexes are kept apart from the param stack, tagged with the control word
+that left them, so a block can't be closed by the wrong word (e.g., "do" by
+"until").
+
+\param kind: The control word leaving the index
+\param index: Index of the cell in the code of the entry being compiled
+*/
+// -----------------------------------------------------------------------------
+static void push_control(ControlKind kind, gint64 index) {
+    ControlFrame *frame = g_new(ControlFrame, 1);
+    frame->entry = compiling_entry();
+    frame->index = index;
+    frame->kind = kind;
+    _vm->control_frames = g_slist_prepend(_vm->control_frames, frame);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Checks that a control frame holds an index left by the control word that
+    opens a block (e.g., "do" for "loop").
+
+The index must have been left by one of the specified control words in the
+entry being compiled (not, e.g., in a definition around a quotation).
+
+\param gp_entry: Entry for the control word closing the block (used for the error message)
+\param n: Position of the frame (0 is the innermost)
+\param opener: Word that opens the block (used for the error message)
+\returns FALSE if the frame isn't such an index (the error is handled here)
+*/
+// -----------------------------------------------------------------------------
+static gboolean check_control(gpointer gp_entry, guint n, const gchar *opener, ControlKind kind_0, ControlKind kind_1) {
+    Entry *entry = gp_entry;
+    ControlFrame *frame = g_slist_nth_data(_vm->control_frames, n);
+
+    gboolean ok = frame && frame->entry == compiling_entry() &&
+                  (frame->kind == kind_0 || frame->kind == kind_1);
+    if (!ok) {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> '%s' without '%s'\n", entry->word, opener);
+    }
+    return ok;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Checks that enough "do" loops are open in the entry being compiled.
+
+Loop indexes are kept on the return stack of the entry's own frame, so "i" and
+"j" can't see loops around a quotation or in a caller.
+
+\param gp_entry: Entry for the word using the loop index (used for the error message)
+\param num_loops: Number of loops that must be open (1 for "i", 2 for "j")
+\returns FALSE if there aren't enough (the error is handled here)
+*/
+// -----------------------------------------------------------------------------
+static gboolean check_loops_open(gpointer gp_entry, guint num_loops) {
+    Entry *entry = gp_entry;
+    Entry *entry_compiling = compiling_entry();
+
+    guint num_open = 0;
+    for (GSList *link = _vm->control_frames; link; link = link->next) {
+        ControlFrame *frame = link->data;
+        if (frame->entry == entry_compiling && frame->kind == CONTROL_DO) num_open++;
+    }
+
+    if (num_open < num_loops) {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> '%s' without 'do'\n", entry->word);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Pops the index left by a control word (e.g., "if" or "begin")
+
+The index must have been checked with check_control.
+*/
+// -----------------------------------------------------------------------------
+static gint64 pop_control() {
+    ControlFrame *frame = _vm->control_frames->data;
+    gint64 result = frame->index;
+
+    _vm->control_frames = g_slist_delete_link(_vm->control_frames, _vm->control_frames);
+    g_free(frame);
+    return result;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Pops the index of a jmp cell pushed by "if" or "else" and points it at a target.
+
+\param entry: The entry being defined
+\param target: Index of the cell to jmp to
+*/
+// -----------------------------------------------------------------------------
+static void resolve_jmp(Entry *entry, gint64 target) {
+    gint64 jmp_index = pop_control();
+
+    Cell *cell_jmp = &g_array_index(entry->code, Cell, jmp_index);
+    cell_jmp->jmp_offset = target - jmp_index;
 }
 
 
@@ -308,19 +735,19 @@ The behavior of the compiled code is to pop a parameter from the stack and
 if it is false, jump to the end of the "if" block. Otherwise, continue through
 the subsequent statements.
 
-We compile this by adding a conditional jump "pseudo entry". Because we don't
-know, at this time of the compilation, where to jump to, we push the pseudo entry
-onto the stack to be filled out later by an "else" or a "then" word.
+We compile this by adding an OP_JMP_IF_FALSE cell. Because we don't know, at
+this time of the compilation, where to jump to, we save the index of the cell
+(see push_control) to be filled out later by an "else" or a "then" word.
 */
 // -----------------------------------------------------------------------------
 static void EC_if(gpointer gp_entry) {
-    Entry *entry_latest = latest_entry();
-    Param *pseudo_param = new_pseudo_entry_param("jmp-if-false", EC_jmp_if_false);
-    add_entry_param(entry_latest, pseudo_param);
+    if (!check_compiling(gp_entry)) return;
+
+    Entry *entry_latest = compiling_entry();
+    add_entry_cell(entry_latest, OP_JMP_IF_FALSE);
 
-    // Push pseudo_param Entry onto stack so we can fill it out later
-    Param *param_pseudo_entry = new_entry_param(&pseudo_param->val_pseudo_entry);
-    push_param(param_pseudo_entry);
+    // Save index of jmp cell so we can fill it out later
+    push_control(CONTROL_IF, entry_latest->code->len - 1);
 }
 
 
@@ -329,33 +756,27 @@ static void EC_if(gpointer gp_entry) {
 /** Implements the "else" block of a conditional part of a definition.
 
 The "else" should correspond to an earlier "if". At this point, we know where
-the "if" should jump to if the condition is false. We store this in the
-"pseudo entry" of the earlier "if" by popping it off the stack and setting
-its first parameter to the offset into the definition's instruction sequence.
+the "if" should jump to if the condition is false: just past the unconditional
+jmp that "else" adds to skip over the "else" block. We pop the index of the
+"if" cell and fill in its offset.
 
-The "else" word marks the end of the "if" section and so an uncondtional
-jmp must be added to the definition first. Similar to the "if" jmp, we
-will need to fill out the jmp target later, so we push it onto the stack.
+Similar to the "if" jmp, we will need to fill out the target of the "else" jmp
+later, so we save its index.
 */
 // -----------------------------------------------------------------------------
 static void EC_else(gpointer gp_entry) {
-    Entry *entry_latest = latest_entry();
+    if (!check_compiling(gp_entry)) return;
+    if (!check_control(gp_entry, 0, "if", CONTROL_IF, CONTROL_IF)) return;
 
-    // Pop param so we can fill out the target for the jmp
-    Param *param_jmp_entry = pop_param();
-    Entry *entry_jmp = param_jmp_entry->val_entry;
-    Param *param_jmp_target = new_int_param(g_sequence_get_length(entry_latest->params) + 1);
-    add_entry_param(entry_jmp, param_jmp_target);
+    Entry *entry_latest = compiling_entry();
 
-    // Add the jmp param
-    Param *pseudo_param = new_pseudo_entry_param("jmp", EC_jmp);
-    add_entry_param(entry_latest, pseudo_param);
+    // The "if" should jmp just past the "else" jmp we're about to add
+    resolve_jmp(entry_latest, entry_latest->code->len + 1);
 
-    // Push pseudo_param Entry onto stack so we can fill it out later
-    Param *param_pseudo_entry = new_entry_param(&pseudo_param->val_pseudo_entry);
-    push_param(param_pseudo_entry);
+    add_entry_cell(entry_latest, OP_JMP);
 
-    free_param(param_jmp_entry);
+    // Save index of jmp cell so we can fill it out later
+    push_control(CONTROL_ELSE, entry_latest->code->len - 1);
 }
 
 
@@ -363,68 +784,182 @@ static void EC_else(gpointer gp_entry) {
 // -----------------------------------------------------------------------------
 /** Implements the end of a conditional section of code.
 
-This pops a "pseudo entry" and sets its jmp target to be the next instruction.
+This pops the index of a jmp cell and sets its target to be the next instruction.
 */
 // -----------------------------------------------------------------------------
 static void EC_then(gpointer gp_entry) {
-    Entry *entry_latest = latest_entry();
+    if (!check_compiling(gp_entry)) return;
+    if (!check_control(gp_entry, 0, "if", CONTROL_IF, CONTROL_ELSE)) return;
+
+    Entry *entry_latest = compiling_entry();
+    resolve_jmp(entry_latest, entry_latest->code->len);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Starts a counted loop.
+
+(limit start -- ) at runtime. The body runs with the index going from start up
+to (but not including) limit. If start >= limit, the body is skipped.
+
+We compile an OP_DO cell, which moves the limit and index to the return stack,
+and save its index so "loop" can fill out where to jmp to when the loop is
+skipped.
+*/
+// -----------------------------------------------------------------------------
+static void EC_do(gpointer gp_entry) {
+    if (!check_compiling(gp_entry)) return;
+
+    Entry *entry_latest = compiling_entry();
+    add_entry_cell(entry_latest, OP_DO);
+
+    // Save index of do cell so "loop" can fill it out
+    push_control(CONTROL_DO, entry_latest->code->len - 1);
+}
 
-    // Pop param so we can fill out the target for the jmp
-    Param *param_jmp_entry = pop_param();
-    Entry *entry_jmp = param_jmp_entry->val_entry;
-    Param *param_jmp_target = new_int_param(g_sequence_get_length(entry_latest->params));
-    add_entry_param(entry_jmp, param_jmp_target);
 
-    free_param(param_jmp_entry);
+
+// -----------------------------------------------------------------------------
+/** Ends a counted loop.
+
+The OP_LOOP cell jmps back to the cell after the "do" cell, and the "do" cell
+jmps just past the OP_LOOP cell to skip the loop.
+*/
+// -----------------------------------------------------------------------------
+static void EC_loop(gpointer gp_entry) {
+    if (!check_compiling(gp_entry)) return;
+    if (!check_control(gp_entry, 0, "do", CONTROL_DO, CONTROL_DO)) return;
+
+    Entry *entry_latest = compiling_entry();
+    ControlFrame *frame_do = _vm->control_frames->data;
+    gint64 do_index = frame_do->index;
+    resolve_jmp(entry_latest, entry_latest->code->len + 1);
+
+    Cell *cell_loop = add_entry_cell(entry_latest, OP_LOOP);
+    cell_loop->jmp_offset = (do_index + 1) - (entry_latest->code->len - 1);
 }
 
 
 
 // -----------------------------------------------------------------------------
-/** Implements a conditional jmp by updating the instruction pointer.
+/** Compiles code to push the index of the innermost loop.
+
+( -- index) at runtime
+*/
+// -----------------------------------------------------------------------------
+static void EC_loop_i(gpointer gp_entry) {
+    if (!check_compiling(gp_entry)) return;
+    if (!check_loops_open(gp_entry, 1)) return;
+    add_entry_cell(compiling_entry(), OP_LOOP_INDEX)->loop_level = 0;
+}
+
 
-This pops a param off the stack. If its val_int is 0, then it does a jmp to
-the instruction at the offset specified in its first param.
 
+// -----------------------------------------------------------------------------
+/** Compiles code to push the index of the loop around the innermost one.
+
+( -- index) at runtime
 */
 // -----------------------------------------------------------------------------
-static void EC_jmp_if_false(gpointer gp_entry) {
-    Entry *entry = gp_entry;
+static void EC_loop_j(gpointer gp_entry) {
+    if (!check_compiling(gp_entry)) return;
+    if (!check_loops_open(gp_entry, 2)) return;
+    add_entry_cell(compiling_entry(), OP_LOOP_INDEX)->loop_level = 1;
+}
 
-    Param *param_bool = pop_param();
-    // If false, move the instruction pointer according to the entry's first param
-    if (param_bool->val_int == 0) {
-        // Get first param of entry
-        GSequenceIter *iter = g_sequence_get_iter_at_pos(entry->params, 0);
-        Param *param0 = g_sequence_get(iter);
 
-        // Update the instruction pointer
-        GSequence *instructions = g_sequence_iter_get_sequence(_ip);
-        _ip = g_sequence_get_iter_at_pos(instructions, param0->val_int);
-    }
 
-    free_param(param_bool);
+// -----------------------------------------------------------------------------
+/** Starts an indefinite loop ("begin ... until" or "begin ... while ... repeat").
+
+Nothing is compiled. We save the index of the next cell so the end of the loop
+can jmp back to it.
+*/
+// -----------------------------------------------------------------------------
+static void EC_begin(gpointer gp_entry) {
+    if (!check_compiling(gp_entry)) return;
+
+    Entry *entry_latest = compiling_entry();
+    push_control(CONTROL_BEGIN, entry_latest->code->len);
 }
 
 
 
 // -----------------------------------------------------------------------------
-/** Implements an unconditional jmp by updating the instruction pointer.
+/** Ends a "begin" loop that runs until a condition is true.
 
-This sets the instruction pointer to the offset specified in the entry's
-first param.
+(bool -- ) at runtime. This compiles a conditional jmp back to the "begin".
 */
 // -----------------------------------------------------------------------------
-static void EC_jmp(gpointer gp_entry) {
-    Entry *entry = gp_entry;
+static void EC_until(gpointer gp_entry) {
+    if (!check_compiling(gp_entry)) return;
+    if (!check_control(gp_entry, 0, "begin", CONTROL_BEGIN, CONTROL_BEGIN)) return;
+
+    Entry *entry_latest = compiling_entry();
+    gint64 begin_index = pop_control();
+
+    Cell *cell_jmp = add_entry_cell(entry_latest, OP_JMP_IF_FALSE);
+    cell_jmp->jmp_offset = begin_index - (entry_latest->code->len - 1);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Exits a "begin" loop if a condition is false.
+
+(bool -- ) at runtime. Like "if", this compiles a conditional jmp and saves its
+index so "repeat" can point it past the end of the loop.
+*/
+// -----------------------------------------------------------------------------
+static void EC_while(gpointer gp_entry) {
+    if (!check_compiling(gp_entry)) return;
+
+    Entry *entry_latest = compiling_entry();
+    add_entry_cell(entry_latest, OP_JMP_IF_FALSE);
+
+    // Save index of jmp cell so "repeat" can fill it out
+    push_control(CONTROL_WHILE, entry_latest->code->len - 1);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Ends a "begin ... while" loop.
+
+This compiles a jmp back to the "begin" and points the "while" jmp just past it.
+*/
+// -----------------------------------------------------------------------------
+static void EC_repeat(gpointer gp_entry) {
+    if (!check_compiling(gp_entry)) return;
+    if (!check_control(gp_entry, 0, "while", CONTROL_WHILE, CONTROL_WHILE)) return;
+    if (!check_control(gp_entry, 1, "begin", CONTROL_BEGIN, CONTROL_BEGIN)) return;
 
-    // Get first param of entry
-    GSequenceIter *iter = g_sequence_get_iter_at_pos(entry->params, 0);
-    Param *param0 = g_sequence_get(iter);
+    Entry *entry_latest = compiling_entry();
 
-    // Update the instruction pointer
-    GSequence *instructions = g_sequence_iter_get_sequence(_ip);
-    _ip = g_sequence_get_iter_at_pos(instructions, param0->val_int);
+    // The "while" jmp is on top of the "begin" index
+    resolve_jmp(entry_latest, entry_latest->code->len + 1);
+    gint64 begin_index = pop_control();
+
+    Cell *cell_jmp = add_entry_cell(entry_latest, OP_JMP);
+    cell_jmp->jmp_offset = begin_index - (entry_latest->code->len - 1);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Compiles a call to the definition (or quotation) being compiled.
+
+The entry can't be found by name until it's complete, so this is how a
+definition calls itself. A recursive call just before ";" becomes a tail call
+(see optimize.c), so it runs in constant return stack space.
+*/
+// -----------------------------------------------------------------------------
+static void EC_recurse(gpointer gp_entry) {
+    if (!check_compiling(gp_entry)) return;
+
+    Entry *entry_latest = compiling_entry();
+    add_entry_cell(entry_latest, OP_CALL)->entry = entry_latest;
 }
 
 
@@ -439,13 +974,31 @@ static void EC_print_definition(gpointer gp_entry) {
 
     if (!entry) {
         handle_error(ERR_UNKNOWN_WORD);
-        fprintf(stderr, "-----> %s\n", param_word->val_string);
+        fprintf(_vm->err, "-----> %s\n", param_word->val_string);
         goto done;
     }
 
-    FOREACH_SEQ(iter, entry->params) {
-        Param *p = g_sequence_get(iter);
-        print_param(stdout, p);
+    if (entry->effect.known) {
+        fprintf(_vm->out, "( %d -- %d )\n", entry->effect.num_in, entry->effect.num_out);
+    }
+
+    if (entry->code) {
+        for (guint i=0; i < entry->code->len; i++) {
+            print_cell(_vm->out, &g_array_index(entry->code, Cell, i));
+        }
+    }
+    else {
+        FOREACH_SEQ(iter, entry->params) {
+            Param *p = g_sequence_get(iter);
+            print_param(_vm->out, p);
+        }
+    }
+
+    if (entry->int_code) {
+        fprintf(_vm->out, "For integers:\n");
+        for (guint i=0; i < entry->int_code->len; i++) {
+            print_cell(_vm->out, &g_array_index(entry->int_code, Cell, i));
+        }
     }
 
 done:
@@ -455,47 +1008,345 @@ done:
 
 
 
+// -----------------------------------------------------------------------------
+/** Reports that a definition was entered without the values it needs
+*/
+// -----------------------------------------------------------------------------
+static void report_missing_inputs(const Entry *entry) {
+    guint depth = get_stack_depth();
+    handle_error(ERR_STACK_UNDERFLOW);
+    fprintf(_vm->err, "-----> '%s' needs %d values, but the stack has %d\n", entry->word, entry->effect.num_in, depth);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns the first cell of the code to run for an entry.
+
+If the entry has integer code (see specialize.c) and its inputs are all
+integers, that's used. Otherwise, the generic code is. The caller must have
+checked that the stack has the entry's inputs.
+*/
+// -----------------------------------------------------------------------------
+static inline Cell *entry_code(const Entry *entry) {
+    if (entry->int_code) {
+        guint i;
+        for (i=0; i < entry->effect.num_in; i++) {
+            if (STACK_CELL_UNCHECKED(i)->type != 'I') break;
+        }
+        if (i == entry->effect.num_in) {
+            return &g_array_index(entry->int_code, Cell, 0);
+        }
+    }
+    return &g_array_index(entry->code, Cell, 0);
+}
+
+
+
+/** Replaces the top two integers on the stack with the result of a C operator
+    in integer code and dispatches the next cell
+*/
+#define INT_BINARY_OP(_op_) \
+    STACK_CELL_UNCHECKED(1)->val_int = STACK_CELL_UNCHECKED(1)->val_int _op_ STACK_CELL_UNCHECKED(0)->val_int; \
+    DROP_INLINE_CELLS_UNCHECKED(1); \
+    DISPATCH()
+
+
+
+// -----------------------------------------------------------------------------
+/** Dispatch macros for the inner interpreter.
+
+With GCC (and compatible compilers), each cell jumps straight to the code for
+the next cell's op through a table of label addresses ("computed goto"). This
+avoids the bounds check and the shared indirect branch of a switch.
+Elsewhere, or when built with -DKIT_NO_COMPUTED_GOTO, a portable switch is used.
+*/
+// -----------------------------------------------------------------------------
+#if defined(__GNUC__) && !defined(KIT_NO_COMPUTED_GOTO)
+#define USE_COMPUTED_GOTO 1
+#endif
+
+#ifdef USE_COMPUTED_GOTO
+#define DISPATCH_BEGIN()  DISPATCH();
+#define DISPATCH()        cell = _vm->ip++; PROFILE_CELL_PAIR(cell); goto *dispatch_table[cell->op]
+#define TARGET(_op_)      label_##_op_
+#define DISPATCH_END()
+#else
+#define DISPATCH_BEGIN()  for (;;) { cell = _vm->ip++; PROFILE_CELL_PAIR(cell); switch(cell->op) {
+#define DISPATCH()        continue
+#define TARGET(_op_)      case _op_
+#define DISPATCH_END()    default: goto unknown_op; } }
+#endif
+
+
+
 // -----------------------------------------------------------------------------
 /** Executes a definition
 
-This starts by pushing the current _ip onto the return stack and then setting
-the _ip to the first parameter of the entry's definition (stored in its params
-field). From there, each parameter of the definition is executed sequentially. If
-one of these parameters is a Dictionary entry, it will be executed by this same
-function, which will result in the return stack noting the place to return
-once that execution is complete.
+This is the inner interpreter. It starts by pushing the current _vm->ip onto the
+return stack and then setting the _vm->ip to the first cell of the entry's compiled
+code. From there, each cell is executed in turn by incrementing _vm->ip.
+
+Calls to other definitions do not recurse in C: the return address is pushed
+onto the return stack and _vm->ip is set to the callee's first cell. OP_RETURN
+pops the return stack, and once the frame pushed by this invocation has been
+popped, we're done. Forth call depth therefore only grows the return stack, and
+calls in tail position (OP_TAIL_CALL) don't even do that.
+
+Primitives are called directly. A primitive may itself execute definitions
+(e.g., via execute_string), which runs a nested inner interpreter.
+
+If an error occurs, handle_error clears _vm->ip and the return stack, which
+stops every running inner interpreter.
+
+Definitions with verified stack effects (see stack_effect.c) have their stack
+depth checked when they're entered, so their unchecked ops (e.g., OP_DUP) can
+skip the check. For other definitions, effect.num_in is 0. Once the depth is
+checked, entry_code picks the integer code of a definition if its inputs allow.
 */
 // -----------------------------------------------------------------------------
-static void EC_execute(gpointer gp_entry) {
+void EC_execute(gpointer gp_entry) {
     Entry *entry = gp_entry;
-    Param *cur_param;
-    Entry *pseudo_entry;
+    Entry *callee;
+    Cell *cell;
+    StackCell *cell_bool;
+    StackCell *cell_obj;
+    StackCell *cell_start;
+    StackCell *cell_limit;
+    ReturnSlot *loop_slot;
+    StackCell cell_tmp;
+    Param scratch_bool;
+    Param *param_value;
+
+#ifdef USE_COMPUTED_GOTO
+    static void *dispatch_table[] = {
+        [OP_CALL] = &&label_OP_CALL,
+        [OP_PUSH_LITERAL] = &&label_OP_PUSH_LITERAL,
+        [OP_JMP] = &&label_OP_JMP,
+        [OP_JMP_IF_FALSE] = &&label_OP_JMP_IF_FALSE,
+        [OP_RETURN] = &&label_OP_RETURN,
+        [OP_TAIL_CALL] = &&label_OP_TAIL_CALL,
+        [OP_DO] = &&label_OP_DO,
+        [OP_LOOP] = &&label_OP_LOOP,
+        [OP_LOOP_INDEX] = &&label_OP_LOOP_INDEX,
+        [OP_DUP] = &&label_OP_DUP,
+        [OP_SWAP] = &&label_OP_SWAP,
+        [OP_DROP] = &&label_OP_DROP,
+        [OP_INT_LITERAL] = &&label_OP_INT_LITERAL,
+        [OP_INT_JMP_IF_FALSE] = &&label_OP_INT_JMP_IF_FALSE,
+        [OP_INT_CALL] = &&label_OP_INT_CALL,
+        [OP_INT_ADD] = &&label_OP_INT_ADD,
+        [OP_INT_SUBTRACT] = &&label_OP_INT_SUBTRACT,
+        [OP_INT_MULTIPLY] = &&label_OP_INT_MULTIPLY,
+        [OP_INT_EQUAL] = &&label_OP_INT_EQUAL,
+        [OP_INT_NOT_EQUAL] = &&label_OP_INT_NOT_EQUAL,
+        [OP_INT_LESS] = &&label_OP_INT_LESS,
+        [OP_INT_GREATER] = &&label_OP_INT_GREATER,
+        [OP_INT_LESS_EQUAL] = &&label_OP_INT_LESS_EQUAL,
+        [OP_INT_GREATER_EQUAL] = &&label_OP_INT_GREATER_EQUAL,
+        [OP_LITERAL_CALL] = &&label_OP_LITERAL_CALL,
+        [OP_FETCH_VARIABLE] = &&label_OP_FETCH_VARIABLE,
+        [OP_GET_FIELD] = &&label_OP_GET_FIELD
+    };
+#endif
+
+    // Our frame is done when the return stack drops back to this depth
+    guint base_depth = get_stack_r_depth();
+
+    if (get_stack_depth() < entry->effect.num_in) {
+        report_missing_inputs(entry);
+        return;
+    }
+    if (!push_param_r(_vm->ip)) return;
+    _vm->ip = entry_code(entry);
 
-    push_param_r(_ip);
+    DISPATCH_BEGIN()
 
-    _ip = g_sequence_get_begin_iter(entry->params);
+    TARGET(OP_LITERAL_CALL):
+        push_param_copy(cell->literal);
+        // Falls through to call the entry
 
-    while (_ip) {
-        cur_param = g_sequence_get(_ip);
-        _ip = g_sequence_iter_next(_ip);
+    TARGET(OP_CALL):
+        callee = cell->entry;
+        if (callee->routine == EC_execute) {
+            if (get_stack_depth() < callee->effect.num_in) {
+                report_missing_inputs(callee);
+                return;
+            }
+            if (!push_param_r(_vm->ip)) return;
+            _vm->ip = entry_code(callee);
+        }
+        else {
+            callee->routine(callee);
+            if (!_vm->ip) return;   // An error reset the interpreter
+        }
+        DISPATCH();
 
-        switch(cur_param->type) {
-            case 'E':
-                execute(cur_param->val_entry);
-                break;
+    TARGET(OP_PUSH_LITERAL):
+        push_param_copy(cell->literal);
+        DISPATCH();
 
-            case 'P':
-                pseudo_entry = &cur_param->val_pseudo_entry;
-                pseudo_entry->routine(pseudo_entry);
-                break;
+    TARGET(OP_JMP):
+        _vm->ip = cell + cell->jmp_offset;
+        DISPATCH();
 
-            default:
-                handle_error(ERR_UNKNOWN_WORD);
-                fprintf(stderr, "----->");
-                print_param(stderr, cur_param);
-                return;
+    TARGET(OP_JMP_IF_FALSE):
+        cell_bool = stack_cell(0);
+        if (!cell_bool) {
+            handle_error(ERR_STACK_UNDERFLOW);
+            return;
         }
-    }
+        // Integers are checked here since they're by far the most common flags
+        if (cell_bool->type == 'I' ? cell_bool->val_int == 0
+                                   : !is_true_param(cell_param(cell_bool, &scratch_bool))) {
+            _vm->ip = cell + cell->jmp_offset;
+        }
+        drop_cells(1);
+        DISPATCH();
+
+    TARGET(OP_RETURN):
+        _vm->ip = pop_param_r();
+        if (get_stack_r_depth() <= base_depth) return;
+        DISPATCH();
+
+    TARGET(OP_TAIL_CALL):
+        // The callee returns straight to our caller, so no frame is pushed
+        if (get_stack_depth() < cell->entry->effect.num_in) {
+            report_missing_inputs(cell->entry);
+            return;
+        }
+        _vm->ip = entry_code(cell->entry);
+        DISPATCH();
+
+    TARGET(OP_DUP):
+        push_cell_copy(STACK_CELL_UNCHECKED(0));
+        DISPATCH();
+
+    TARGET(OP_SWAP):
+        cell_tmp = *STACK_CELL_UNCHECKED(0);
+        *STACK_CELL_UNCHECKED(0) = *STACK_CELL_UNCHECKED(1);
+        *STACK_CELL_UNCHECKED(1) = cell_tmp;
+        DISPATCH();
+
+    TARGET(OP_DROP):
+        drop_cells(1);
+        DISPATCH();
+
+    TARGET(OP_INT_LITERAL):
+        push_int(cell->val_int);
+        DISPATCH();
+
+    TARGET(OP_INT_JMP_IF_FALSE):
+        if (STACK_CELL_UNCHECKED(0)->val_int == 0) {
+            _vm->ip = cell + cell->jmp_offset;
+        }
+        DROP_INLINE_CELLS_UNCHECKED(1);
+        DISPATCH();
+
+    TARGET(OP_INT_CALL):
+        if (!push_param_r(_vm->ip)) return;
+        _vm->ip = &g_array_index(cell->entry->int_code, Cell, 0);
+        DISPATCH();
+
+    TARGET(OP_INT_ADD):
+        INT_BINARY_OP(+);
+
+    TARGET(OP_INT_SUBTRACT):
+        INT_BINARY_OP(-);
+
+    TARGET(OP_INT_MULTIPLY):
+        INT_BINARY_OP(*);
+
+    TARGET(OP_INT_EQUAL):
+        INT_BINARY_OP(==);
+
+    TARGET(OP_INT_NOT_EQUAL):
+        INT_BINARY_OP(!=);
+
+    TARGET(OP_INT_LESS):
+        INT_BINARY_OP(<);
+
+    TARGET(OP_INT_GREATER):
+        INT_BINARY_OP(>);
+
+    TARGET(OP_INT_LESS_EQUAL):
+        INT_BINARY_OP(<=);
+
+    TARGET(OP_INT_GREATER_EQUAL):
+        INT_BINARY_OP(>=);
+
+    TARGET(OP_DO):
+        cell_start = stack_cell(0);
+        cell_limit = stack_cell(1);
+        if (!cell_limit) {
+            handle_error(ERR_STACK_UNDERFLOW);
+            return;
+        }
+        if (cell_start->type != 'I' || cell_limit->type != 'I') {
+            handle_error(ERR_INVALID_PARAM);
+            fprintf(_vm->err, "-----> 'do' expects an integer limit and start\n");
+            return;
+        }
+        if (cell_start->val_int >= cell_limit->val_int) {
+            _vm->ip = cell + cell->jmp_offset;
+        }
+        else if (!push_loop_r(cell_limit->val_int, cell_start->val_int)) {
+            return;
+        }
+        drop_cells(2);
+        DISPATCH();
+
+    TARGET(OP_LOOP):
+        // The loop's limit is in the slot below its index
+        loop_slot = loop_slot_r(0);
+        if (++loop_slot->val_int < (loop_slot - 1)->val_int) {
+            _vm->ip = cell + cell->jmp_offset;
+        }
+        else {
+            drop_loop_r();
+        }
+        DISPATCH();
+
+    TARGET(OP_LOOP_INDEX):
+        loop_slot = loop_slot_r(cell->loop_level);
+        if (!loop_slot) {
+            handle_error(ERR_GENERIC_ERROR);
+            fprintf(_vm->err, "-----> Not in a loop\n");
+            return;
+        }
+        push_int(loop_slot->val_int);
+        DISPATCH();
+
+    TARGET(OP_FETCH_VARIABLE):
+        push_param_copy(g_sequence_get(g_sequence_get_begin_iter(cell->entry->params)));
+        DISPATCH();
+
+    TARGET(OP_GET_FIELD):
+        cell_obj = stack_cell(0);
+        if (cell_obj && cell_obj->type == 'C' && cell_obj->val_param->val_custom_type->get_field) {
+            param_value = cell_obj->val_param->val_custom_type->get_field(cell_obj->val_param,
+                                                                         cell->literal->val_string);
+            if (param_value) {
+                drop_cells(1);
+                push_param(param_value);
+                DISPATCH();
+            }
+        }
+
+        // Let "@field" report the error
+        push_param_copy(cell->literal);
+        cell->entry->routine(cell->entry);
+        if (!_vm->ip) return;
+        DISPATCH();
+
+    DISPATCH_END()
+
+#ifndef USE_COMPUTED_GOTO
+unknown_op:
+    handle_error(ERR_UNKNOWN_WORD);
+    fprintf(_vm->err, "----->");
+    print_cell(_vm->err, cell);
+#endif
 }
 
 
@@ -507,7 +1358,7 @@ static void EC_execute(gpointer gp_entry) {
 // -----------------------------------------------------------------------------
 static void EC_print(gpointer gp_entry) {
     Param *param = pop_param();
-    print_param(stdout, param);  // This frees the param
+    print_param(_vm->out, param);  // This frees the param
     free_param(param);
 }
 
@@ -519,18 +1370,27 @@ static void EC_print(gpointer gp_entry) {
 (item -- )
 */
 // -----------------------------------------------------------------------------
-static void EC_pop(gpointer gp_entry) {
-    Param *param = pop_param();
-    free_param(param);
+void EC_pop(gpointer gp_entry) {
+    drop_cells(1);
 }
 
 
 // -----------------------------------------------------------------------------
 /** Pops a parameter from the stack, but does not free its memory
+
+Inline values (e.g., integers) have no Param to keep, so they're just dropped.
 */
 // -----------------------------------------------------------------------------
-static void EC_drop(gpointer gp_entry) {
-    pop_param();
+void EC_drop(gpointer gp_entry) {
+    StackCell *cell = stack_cell(0);
+    if (!cell) return;
+
+    if (is_inline_type(cell->type)) {
+        drop_cells(1);
+    }
+    else {
+        pop_param();
+    }
 }
 
 
@@ -540,9 +1400,13 @@ static void EC_drop(gpointer gp_entry) {
 
 */
 // -----------------------------------------------------------------------------
-static void EC_dup(gpointer gp_entry) {
-    COPY_PARAM(param_new, top());
-    push_param(param_new);
+void EC_dup(gpointer gp_entry) {
+    StackCell *cell = stack_cell(0);
+    if (!cell) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        return;
+    }
+    push_cell_copy(cell);
 }
 
 
@@ -553,12 +1417,17 @@ static void EC_dup(gpointer gp_entry) {
 (p1 p2 -- p2 p1)
 */
 // -----------------------------------------------------------------------------
-static void EC_swap(gpointer gp_entry) {
-    Param *p2 = pop_param();
-    Param *p1 = pop_param();
+void EC_swap(gpointer gp_entry) {
+    StackCell *p2 = stack_cell(0);
+    StackCell *p1 = stack_cell(1);
+    if (!p1) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        return;
+    }
 
-    push_param(p2);
-    push_param(p1);
+    StackCell tmp = *p2;
+    *p2 = *p1;
+    *p1 = tmp;
 }
 
 
@@ -572,7 +1441,7 @@ This is used with the EC_DB_DOUBLE_GETTER and EC_DB_INT_GETTER macros.
 int set_double_cb(gpointer gp_double_ref, int num_cols, char **values, char **cols) {
     if (num_cols != 1) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> Unexpected num cols in set_double_cb\n");
+        fprintf(_vm->err, "-----> Unexpected num cols in set_double_cb\n");
         return 1;
     }
 
@@ -591,7 +1460,7 @@ int set_double_cb(gpointer gp_double_ref, int num_cols, char **values, char **co
 int set_int_cb(gpointer gp_int_ref, int num_cols, char **values, char **cols) {
     if (num_cols != 1) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> Unexpected num cols in set_int_cb\n");
+        fprintf(_vm->err, "-----> Unexpected num cols in set_int_cb\n");
         return 1;
     }
 
@@ -613,7 +1482,7 @@ This is used with the EC_DB_STR_GETTER macro.
 int set_string_cb(gpointer gp_char_p_ref, int num_cols, char **values, char **cols) {
     if (num_cols != 1) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> Unexpected num cols in set_double_cb\n");
+        fprintf(_vm->err, "-----> Unexpected num cols in set_double_cb\n");
         return 1;
     }
 
@@ -629,8 +1498,6 @@ int set_string_cb(gpointer gp_char_p_ref, int num_cols, char **values, char **co
 */
 // -----------------------------------------------------------------------------
 static gchar *macro_substitute(const gchar *const_str) {
-    GSequence *strings = g_sequence_new(g_free);
-
     gchar *str = g_strdup(const_str);
     guint index = 0;
     while(str[index]) {
@@ -638,12 +1505,18 @@ static gchar *macro_substitute(const gchar *const_str) {
         index++;
     }
 
+    // Most strings don't have any macros
+    if (!strchr(str, '`')) {
+        return str;
+    }
+
+    GSequence *strings = g_sequence_new(g_free);
+
     // =================================
     // Scans string breaking at any `<digit> and performing a macro expansion
     // =================================
     index = 0;
     guint start_word = 0;
-    guint stack_length = g_queue_get_length(_stack);
 
     while(str[index]) {
         // Split string if we hit a "`"
@@ -653,8 +1526,7 @@ static gchar *macro_substitute(const gchar *const_str) {
             }
 
             guint stack_element = str[index+1] - '0';
-            guint stack_index = stack_length - stack_element - 1;
-            const Param *param = g_queue_peek_nth(_stack, stack_index);
+            const Param *param = stack_cell(stack_element)->val_param;
             g_sequence_append(strings, g_strdup(param->val_string));
             index++;
             start_word = index + 1;
@@ -694,8 +1566,21 @@ static gchar *macro_substitute(const gchar *const_str) {
 
 
 
+// -----------------------------------------------------------------------------
+/** Executes a string with macro substitutions.
+
+In execute mode, the string's compiled code is run from the string cache when
+possible. Otherwise, the string is interpreted token by token.
+*/
+// -----------------------------------------------------------------------------
 void execute_string(const gchar *str) {
     gchar *str_new = macro_substitute(str);
+
+    if (_vm->mode == 'E' && execute_cached_string(str_new)) {
+        g_free(str_new);
+        return;
+    }
+
     scan_string(str_new);
 
     while(1) {
@@ -713,7 +1598,13 @@ void execute_string(const gchar *str) {
 
 void process_token(Token token) {
     // If, executing...
-    if (_mode == 'E') {
+    if (_vm->mode == 'E') {
+        // Literals can't name entries, so skip the dictionary lookup
+        if (token.type != 'W') {
+            push_token(token);
+            return;
+        }
+
         Entry *entry = find_entry(token.word);
         if (entry) {
             execute(entry);
@@ -746,44 +1637,27 @@ void push_token(Token token) {
     // Can't push a Word token
     if (token.type == 'W') {
         handle_error(ERR_UNKNOWN_WORD);
-        fprintf(stderr, "----> %s\n", token.word);
+        fprintf(_vm->err, "----> %s\n", token.word);
         return;
     }
 
-    Param *param_new;
-    gint64 val_int;
-    gdouble val_double;
-    gchar *val_str;
-
     switch(token.type) {
         case 'I':
-            val_int = g_ascii_strtoll(token.word, NULL, 10);
-            param_new = new_int_param(val_int);
-            push_param(param_new);
+            push_int(token.val_int);
             break;
 
         case 'D':
-            val_double = g_ascii_strtod(token.word, NULL);
-            param_new = new_double_param(val_double);
-            push_param(param_new);
+            push_double(token.val_double);
             break;
 
         case 'S':
-            // Start copying yyext after first '"'...
-            val_str = g_strdup(yytext+1);
-
-            // ...and NUL out second '"'
-            val_str[yyleng-2] = '\0';
-
-            param_new = new_str_param(val_str);
-            push_param(param_new);
-
-            g_free(val_str);
+            // Copy the token text between the '"' characters
+            push_param(new_str_param_len(token.word+1, token.len-2));
             break;
 
         default:
             handle_error(ERR_UNKNOWN_TOKEN_TYPE);
-            fprintf(stderr, "----> %c: %s\n", token.type, token.word);
+            fprintf(_vm->err, "----> %c: %s\n", token.type, token.word);
             return;
     }
 }
@@ -806,74 +1680,95 @@ static void EC_execute_string(gpointer gp_entry) {
 
 
 
-static void EC_negate(gpointer gp_entry) {
-    Param *param_val = pop_param();
+// -----------------------------------------------------------------------------
+/** Checks that a param is a custom value whose type supports a field operation
 
-    if (param_val->type == 'I') {
-        param_val->val_int *= -1;
+\returns The param's type, or NULL if there was an error (which is handled here)
+*/
+// -----------------------------------------------------------------------------
+static const CustomType *get_field_type(const Param *param_obj, const Param *param_field_name, gboolean is_set) {
+    if (!param_obj || !param_field_name) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        return NULL;
     }
-    else if (param_val->type == 'D') {
-        param_val->val_double *= -1;
+
+    if (param_obj->type != 'C') {
+        handle_error(ERR_INVALID_PARAM);
+        fprintf(_vm->err, "-----> Expected a custom value with fields, not '%c'\n", param_obj->type);
+        return NULL;
     }
-    push_param(param_val);
+
+    const CustomType *result = param_obj->val_custom_type;
+    if ((is_set && !result->set_field) || (!is_set && !result->get_field)) {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> Can't %s fields of %s values\n", is_set ? "set" : "get", result->name);
+        return NULL;
+    }
+    return result;
 }
 
 
-static void EC_not(gpointer gp_entry) {
-    Param *param = pop_param();
 
-    gboolean result = 0;
-    switch (param->type) {
-        case 'I':
-            result = param->val_int == 0 ? 1 : 0;
-            break;
+// -----------------------------------------------------------------------------
+/** Pushes the value of a field of a custom value
 
-        case 'D':
-            result = param->val_double == 0 ? 1 : 0;
-            break;
+(obj field-name -- value)
+*/
+// -----------------------------------------------------------------------------
+void EC_get_field(gpointer gp_entry) {
+    Param *param_field_name = pop_param();
+    Param *param_obj = pop_param();
 
-        case 'S':
-            result = (STR_EQ(param->val_string, "")) ? 1 : 0;
-            break;
+    const CustomType *custom_type = get_field_type(param_obj, param_field_name, FALSE);
+    if (!custom_type) goto done;
 
-        default:
-            handle_error(ERR_GENERIC_ERROR);
-            fprintf(stderr, "-----> Can't 'not' type '%c'\n", param->type);
-            goto done;
+    Param *param_value = custom_type->get_field(param_obj, param_field_name->val_string);
+    if (!param_value) {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> Unknown %s field: %s\n", custom_type->name, param_field_name->val_string);
+        goto done;
     }
-
-    push_param(new_int_param(result));
+    push_param(param_value);
 
 done:
-    free_param(param);
+    free_param(param_field_name);
+    free_param(param_obj);
 }
 
 
-/** Compares two items on stack
-(l r -- boolean)
+
+// -----------------------------------------------------------------------------
+/** Sets the value of a field of a custom value
+
+(obj value field-name -- )
 */
-static void EC_equal(gpointer gp_entry) {
-    Param *param_r = pop_param();
-    Param *param_l = pop_param();
+// -----------------------------------------------------------------------------
+static void EC_set_field(gpointer gp_entry) {
+    Param *param_field_name = pop_param();
+    Param *param_value = pop_param();
+    Param *param_obj = pop_param();
 
-    if (param_l->type != param_r->type) {
-        push_param(new_int_param(0));
-        return;
+    if (!param_value) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        goto done;
     }
 
-    switch (param_l->type) {
-        case 'I':
-            push_param(new_int_param(param_l->val_int == param_r->val_int ? 1 : 0));
-            break;
+    const CustomType *custom_type = get_field_type(param_obj, param_field_name, TRUE);
+    if (!custom_type) goto done;
 
-        default:
-            handle_error(ERR_GENERIC_ERROR);
-            fprintf(stderr, "---->Don't know how to compare '%c'\n", param_l->type);
-            break;
+    if (!custom_type->set_field(param_obj, param_field_name->val_string, param_value)) {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> Unknown %s field: %s\n", custom_type->name, param_field_name->val_string);
     }
+
+done:
+    free_param(param_field_name);
+    free_param(param_value);
+    free_param(param_obj);
 }
 
 
+
 // -----------------------------------------------------------------------------
 /** Defines the basic words in a Forth dictionary
 
@@ -885,6 +1780,12 @@ static void EC_equal(gpointer gp_entry) {
 - pop: ( -- ) Pops stack
 - . ( -- ) Pops stack and prints value
 - .s ( -- ) Prints the values on the stack (nondestructive)
+- .mem ( -- ) Prints allocator statistics
+- .cache-stats ( -- ) Prints string cache counters
+- .pairs ( -- ) Prints the most frequently executed pairs of cells (with --enable-pair-profile)
+
+### Arithmetic and comparison
+- See add_math_words (ec_math.c)
 
 ### Constants and variables
 - constant: (val -- ) Creates a constant
@@ -892,15 +1793,34 @@ static void EC_equal(gpointer gp_entry) {
 - ! (val variable -- ) Stores a value in a variable
 - @ (variable -- ) Fetches the value of a variable
 
+### Fields of custom values
+- @field (obj field-name -- value) Gets a field using the obj's CustomType
+- !field (obj value field-name -- ) Sets a field using the obj's CustomType
+
 ### Definitions
 - : ( -- ) Starts a new definition
 - ; ( -- ) Ends a definition
-- .d (str -- ) Prints the words in a definition
+- .d (str -- ) Prints the words in a definition (as optimized; see optimize.c)
+
+### Quotations
+- [: (immediate) Starts compiling an anonymous block of code
+- ;] (immediate) Ends the block, leaving a quotation ( -- quotation)
 
 ### Branching
 - if (immediate) Used during compile to define branching
 - else (immediate) Used during compile to define branching
 - then (immediate) Used during compile to define branching
+- recurse (immediate) Calls the definition being compiled
+
+### Loops
+- do (immediate) (limit start -- ) Starts a counted loop (skipped if start >= limit)
+- loop (immediate) Ends a counted loop
+- i (immediate) ( -- index) Index of the innermost counted loop
+- j (immediate) ( -- index) Index of the counted loop around the innermost one
+- begin (immediate) Starts an indefinite loop
+- until (immediate) (bool -- ) Ends a "begin" loop, repeating it until bool is true
+- while (immediate) (bool -- ) Leaves a "begin" loop if bool is false
+- repeat (immediate) Ends a "begin ... while" loop
 
 */
 // -----------------------------------------------------------------------------
@@ -908,29 +1828,35 @@ void add_basic_words() {
     Entry *entry;
 
     add_entry(".q")->routine = EC_quit;
-    add_entry(".i")->routine = EC_interactive;
-
-    add_entry(".")->routine = EC_print;
-    add_entry(".s")->routine = EC_print_stack;
-    add_entry("pop")->routine = EC_pop;
-    add_entry("drop")->routine = EC_drop;
-    add_entry("dup")->routine = EC_dup;
-    add_entry("swap")->routine = EC_swap;
-
-    // TODO: Move this to a math lexicon
-    add_entry("negate")->routine = EC_negate;
-    add_entry("not")->routine = EC_not;
-
-    add_entry("constant")->routine = EC_constant;
-    add_entry("variable")->routine = EC_variable;
-    add_entry("!")->routine = EC_store_variable_value;
-    add_entry("@")->routine = EC_fetch_variable_value;
-
-    add_entry("==")->routine = EC_equal;
+    entry = add_entry(".i");
+    entry->parsing = 1;
+    entry->routine = EC_interactive;
+
+    declare_effect(add_entry("."), 1, 0)->routine = EC_print;
+    declare_effect(add_entry(".s"), 0, 0)->routine = EC_print_stack;
+    add_entry(".mem")->routine = EC_print_memory_stats;
+    add_entry(".cache-stats")->routine = EC_print_cache_stats;
+    add_entry(".pairs")->routine = EC_print_pairs;
+    declare_effect(add_entry("pop"), 1, 0)->routine = EC_pop;
+    declare_effect(add_entry("drop"), 1, 0)->routine = EC_drop;
+    declare_effect(add_entry("dup"), 1, 2)->routine = EC_dup;
+    declare_effect(add_entry("swap"), 2, 2)->routine = EC_swap;
+
+    add_math_words();
+
+    declare_effect(add_entry("constant"), 2, 0)->routine = EC_constant;
+    declare_effect(add_entry("variable"), 1, 0)->routine = EC_variable;
+    declare_effect(add_entry("!"), 2, 0)->routine = EC_store_variable_value;
+    declare_effect(add_entry("@"), 1, 1)->routine = EC_fetch_variable_value;
+
+    declare_effect(add_entry("@field"), 2, 1)->routine = EC_get_field;
+    declare_effect(add_entry("!field"), 3, 0)->routine = EC_set_field;
 
     add_entry(",")->routine = EC_execute_string;
 
-    add_entry(":")->routine = EC_define;
+    entry = add_entry(":");
+    entry->parsing = 1;
+    entry->routine = EC_define;
 
     entry = add_entry(";");
     entry->immediate = 1;
@@ -938,6 +1864,14 @@ void add_basic_words() {
 
     add_entry(".d")->routine = EC_print_definition;
 
+    entry = add_entry("[:");
+    entry->immediate = 1;
+    entry->routine = EC_start_quotation;
+
+    entry = add_entry(";]");
+    entry->immediate = 1;
+    entry->routine = EC_end_quotation;
+
     entry = add_entry("if");
     entry->immediate = 1;
     entry->routine = EC_if;
@@ -949,4 +1883,40 @@ void add_basic_words() {
     entry = add_entry("then");
     entry->immediate = 1;
     entry->routine = EC_then;
+
+    entry = add_entry("recurse");
+    entry->immediate = 1;
+    entry->routine = EC_recurse;
+
+    entry = add_entry("do");
+    entry->immediate = 1;
+    entry->routine = EC_do;
+
+    entry = add_entry("loop");
+    entry->immediate = 1;
+    entry->routine = EC_loop;
+
+    entry = add_entry("i");
+    entry->immediate = 1;
+    entry->routine = EC_loop_i;
+
+    entry = add_entry("j");
+    entry->immediate = 1;
+    entry->routine = EC_loop_j;
+
+    entry = add_entry("begin");
+    entry->immediate = 1;
+    entry->routine = EC_begin;
+
+    entry = add_entry("until");
+    entry->immediate = 1;
+    entry->routine = EC_until;
+
+    entry = add_entry("while");
+    entry->immediate = 1;
+    entry->routine = EC_while;
+
+    entry = add_entry("repeat");
+    entry->immediate = 1;
+    entry->routine = EC_repeat;
 }
@@ -14,6 +14,24 @@ int set_string_cb(gpointer gp_char_p_ref, int num_cols, char **values, char **co
 void execute_string(const gchar *str);
 
 void EC_push_param0(gpointer gp_entry);
+void EC_execute(gpointer gp_entry);
+
+// Routines the peephole optimizer recognizes
+void EC_push_entry_address(gpointer gp_entry);
+void EC_fetch_variable_value(gpointer gp_entry);
+void EC_get_field(gpointer gp_entry);
+void EC_pop(gpointer gp_entry);
+void EC_drop(gpointer gp_entry);
+void EC_dup(gpointer gp_entry);
+void EC_swap(gpointer gp_entry);
+
+Entry *compiling_entry();
+void clear_quotations();
+void clear_control_frames();
+void begin_compiling_into(Entry *entry);
+gboolean end_compiling_into(Entry *entry);
+gboolean is_quotation_word(const Entry *entry);
+void execute_block(const Param *param_block);
 
 void process_token(Token token);
 void execute_string(const gchar *str);
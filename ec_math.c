@@ -0,0 +1,494 @@
+/** \file ec_math.c
+
+\brief Defines arithmetic and comparison words.
+
+These words work on the stack cells directly. Integers and doubles are stored
+inline in their cells, so the result of an operation on numbers overwrites the
+left operand's cell and no Params are allocated.
+
+Each operation has a fast path for two integers. Otherwise, if either operand
+is a double, both are converted to doubles. Comparisons also work on two
+strings.
+
+All of these words (except "/" and "mod", which fail when dividing by 0) are
+pure, so the optimizer folds them when their inputs are literals.
+*/
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns the value of a numeric cell as a double
+*/
+// -----------------------------------------------------------------------------
+static gdouble cell_to_double(const StackCell *cell) {
+    return cell->type == 'I' ? (gdouble) cell->val_int : cell->val_double;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if a cell holds a number
+*/
+// -----------------------------------------------------------------------------
+static gboolean is_number_cell(const StackCell *cell) {
+    return cell->type == 'I' || cell->type == 'D';
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Gets the two operands of a binary word.
+
+\param word: Word for error messages
+\returns FALSE if there aren't two numbers on the stack (the error is handled here)
+*/
+// -----------------------------------------------------------------------------
+static gboolean get_number_operands(const gchar *word, StackCell **cell_l, StackCell **cell_r) {
+    *cell_r = stack_cell(0);
+    *cell_l = stack_cell(1);
+    if (!*cell_l) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        return FALSE;
+    }
+
+    if (!is_number_cell(*cell_l) || !is_number_cell(*cell_r)) {
+        gchar type_l = (*cell_l)->type;
+        gchar type_r = (*cell_r)->type;
+        handle_error(ERR_INVALID_PARAM);
+        fprintf(_vm->err, "-----> Can't '%s' types '%c' and '%c'\n", word, type_l, type_r);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Compares two values.
+
+Numbers are compared by value (an integer and a double are compared as
+doubles), and strings are compared with strcmp. The comparison words and the
+sequence sorting words all compare values this way. NaN can't be compared with
+anything, so it's unequal even to itself.
+
+\param result: Set to a negative number, 0, or a positive number if the left
+               value is less than, equal to, or greater than the right one
+\returns FALSE if the values can't be compared
+*/
+// -----------------------------------------------------------------------------
+gboolean compare_values(const Param *param_l, const Param *param_r, gint *result) {
+    if (param_l->type == 'I' && param_r->type == 'I') {
+        *result = (param_l->val_int > param_r->val_int) - (param_l->val_int < param_r->val_int);
+        return TRUE;
+    }
+
+    gboolean is_number_l = param_l->type == 'I' || param_l->type == 'D';
+    gboolean is_number_r = param_r->type == 'I' || param_r->type == 'D';
+    if (is_number_l && is_number_r) {
+        gdouble val_l = param_l->type == 'I' ? (gdouble) param_l->val_int : param_l->val_double;
+        gdouble val_r = param_r->type == 'I' ? (gdouble) param_r->val_int : param_r->val_double;
+        if (isnan(val_l) || isnan(val_r)) return FALSE;
+
+        *result = (val_l > val_r) - (val_l < val_r);
+        return TRUE;
+    }
+
+    if (param_l->type == 'S' && param_r->type == 'S') {
+        *result = g_strcmp0(param_l->val_string, param_r->val_string);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Compares two cells (see compare_values).
+*/
+// -----------------------------------------------------------------------------
+static gboolean compare_cells(const StackCell *cell_l, const StackCell *cell_r, gint *result) {
+    if (cell_l->type == 'I' && cell_r->type == 'I') {
+        *result = (cell_l->val_int > cell_r->val_int) - (cell_l->val_int < cell_r->val_int);
+        return TRUE;
+    }
+
+    Param scratch_l, scratch_r;
+    return compare_values(cell_param(cell_l, &scratch_l), cell_param(cell_r, &scratch_r), result);
+}
+
+
+
+/** Defines a word that applies a C operator to two numbers
+
+(l r -- l op r)
+
+Two integers give an integer; otherwise, the result is a double.
+*/
+#define EC_ARITHMETIC(_ec_func_name_, _word_, _op_) \
+    static void _ec_func_name_(gpointer gp_entry) { \
+        StackCell *cell_l, *cell_r; \
+        if (!get_number_operands(_word_, &cell_l, &cell_r)) return; \
+ \
+        if (cell_l->type == 'I' && cell_r->type == 'I') { \
+            cell_l->val_int = cell_l->val_int _op_ cell_r->val_int; \
+        } \
+        else { \
+            cell_l->val_double = cell_to_double(cell_l) _op_ cell_to_double(cell_r); \
+            cell_l->type = 'D'; \
+        } \
+        drop_cells(1); \
+    }
+
+EC_ARITHMETIC(EC_add, "+", +)
+EC_ARITHMETIC(EC_subtract, "-", -)
+EC_ARITHMETIC(EC_multiply, "*", *)
+
+
+
+/** Defines a word that compares two values
+
+(l r -- bool)
+
+Values that can't be compared (e.g., a number and a string) are an error
+unless is_equality is TRUE, in which case they are simply unequal.
+*/
+#define EC_COMPARISON(_ec_func_name_, _word_, _op_, _is_equality_) \
+    static void _ec_func_name_(gpointer gp_entry) { \
+        StackCell *cell_r = stack_cell(0); \
+        StackCell *cell_l = stack_cell(1); \
+        if (!cell_l) { \
+            handle_error(ERR_STACK_UNDERFLOW); \
+            return; \
+        } \
+ \
+        if (cell_l->type == 'I' && cell_r->type == 'I') { \
+            cell_l->val_int = cell_l->val_int _op_ cell_r->val_int; \
+            drop_cells(1); \
+            return; \
+        } \
+ \
+        gint cmp; \
+        gboolean result; \
+        if (compare_cells(cell_l, cell_r, &cmp)) { \
+            result = cmp _op_ 0; \
+        } \
+        else if (_is_equality_) { \
+            result = !(0 _op_ 0); \
+        } \
+        else { \
+            gchar type_l = cell_l->type; \
+            gchar type_r = cell_r->type; \
+            handle_error(ERR_INVALID_PARAM); \
+            fprintf(_vm->err, "-----> Can't compare '%c' and '%c' with '%s'\n", type_l, type_r, _word_); \
+            return; \
+        } \
+ \
+        drop_cells(2); \
+        push_int(result); \
+    }
+
+EC_COMPARISON(EC_equal, "==", ==, TRUE)
+EC_COMPARISON(EC_not_equal, "!=", !=, TRUE)
+EC_COMPARISON(EC_less, "<", <, FALSE)
+EC_COMPARISON(EC_greater, ">", >, FALSE)
+EC_COMPARISON(EC_less_equal, "<=", <=, FALSE)
+EC_COMPARISON(EC_greater_equal, ">=", >=, FALSE)
+
+
+
+// -----------------------------------------------------------------------------
+/** Divides two numbers
+
+(l r -- l/r)
+
+Dividing two integers truncates the result. Dividing an integer by 0 is an
+error.
+
+Dividing G_MININT64 by -1 overflows (and traps on most machines), so dividing by
+-1 negates instead, wrapping around like the other integer words.
+*/
+// -----------------------------------------------------------------------------
+static void EC_divide(gpointer gp_entry) {
+    StackCell *cell_l, *cell_r;
+    if (!get_number_operands("/", &cell_l, &cell_r)) return;
+
+    if (cell_l->type == 'I' && cell_r->type == 'I') {
+        if (cell_r->val_int == 0) {
+            handle_error(ERR_GENERIC_ERROR);
+            fprintf(_vm->err, "-----> Division by 0\n");
+            return;
+        }
+        if (cell_r->val_int == -1) {
+            cell_l->val_int = (gint64) (0 - (guint64) cell_l->val_int);
+        }
+        else {
+            cell_l->val_int /= cell_r->val_int;
+        }
+    }
+    else {
+        cell_l->val_double = cell_to_double(cell_l) / cell_to_double(cell_r);
+        cell_l->type = 'D';
+    }
+    drop_cells(1);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Computes the remainder of dividing two numbers
+
+(l r -- l mod r)
+
+The result has the sign of l (as with C's % and fmod). Taking an integer mod 0
+is an error. Anything mod -1 is 0 (C's % would trap on G_MININT64).
+*/
+// -----------------------------------------------------------------------------
+static void EC_mod(gpointer gp_entry) {
+    StackCell *cell_l, *cell_r;
+    if (!get_number_operands("mod", &cell_l, &cell_r)) return;
+
+    if (cell_l->type == 'I' && cell_r->type == 'I') {
+        if (cell_r->val_int == 0) {
+            handle_error(ERR_GENERIC_ERROR);
+            fprintf(_vm->err, "-----> Division by 0\n");
+            return;
+        }
+        if (cell_r->val_int == -1) {
+            cell_l->val_int = 0;
+        }
+        else {
+            cell_l->val_int %= cell_r->val_int;
+        }
+    }
+    else {
+        cell_l->val_double = fmod(cell_to_double(cell_l), cell_to_double(cell_r));
+        cell_l->type = 'D';
+    }
+    drop_cells(1);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Keeps the smaller of two numbers (with its type)
+
+(l r -- min)
+*/
+// -----------------------------------------------------------------------------
+static void EC_min(gpointer gp_entry) {
+    StackCell *cell_l, *cell_r;
+    if (!get_number_operands("min", &cell_l, &cell_r)) return;
+
+    gint cmp = 0;
+    compare_cells(cell_l, cell_r, &cmp);
+    if (cmp > 0) {
+        *cell_l = *cell_r;
+    }
+    drop_cells(1);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Keeps the larger of two numbers (with its type)
+
+(l r -- max)
+*/
+// -----------------------------------------------------------------------------
+static void EC_max(gpointer gp_entry) {
+    StackCell *cell_l, *cell_r;
+    if (!get_number_operands("max", &cell_l, &cell_r)) return;
+
+    gint cmp = 0;
+    compare_cells(cell_l, cell_r, &cmp);
+    if (cmp < 0) {
+        *cell_l = *cell_r;
+    }
+    drop_cells(1);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Replaces a number with its absolute value
+
+(num -- |num|)
+*/
+// -----------------------------------------------------------------------------
+static void EC_abs(gpointer gp_entry) {
+    StackCell *cell = stack_cell(0);
+    if (!cell) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        return;
+    }
+
+    if (cell->type == 'I') {
+        cell->val_int = ABS(cell->val_int);
+    }
+    else if (cell->type == 'D') {
+        cell->val_double = fabs(cell->val_double);
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Negates a number
+
+(num -- -num)
+*/
+// -----------------------------------------------------------------------------
+static void EC_negate(gpointer gp_entry) {
+    StackCell *cell = stack_cell(0);
+    if (!cell) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        return;
+    }
+
+    if (cell->type == 'I') {
+        cell->val_int *= -1;
+    }
+    else if (cell->type == 'D') {
+        cell->val_double *= -1;
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Replaces a value with 1 if it is false (0, 0.0, or "") and with 0 otherwise
+
+(val -- bool)
+
+This uses the same truth test as "if" and filter (see is_true_param), but only
+numbers and strings can be negated.
+*/
+// -----------------------------------------------------------------------------
+static void EC_not(gpointer gp_entry) {
+    StackCell *cell = stack_cell(0);
+    if (!cell) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        return;
+    }
+
+    if (cell->type != 'I' && cell->type != 'D' && cell->type != 'S') {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> Can't 'not' type '%c'\n", cell->type);
+        return;
+    }
+
+    Param scratch;
+    gboolean result = !is_true_param(cell_param(cell, &scratch));
+
+    // Replace the value with the result in place
+    drop_cells(1);
+    push_int(result);
+}
+
+
+
+/** \brief Ops that replace calls to math words in integer code (see specialize.c)
+
+All of these words make integers from integers. Words without an op of their
+own are still called (as OP_CALL).
+*/
+static const struct {
+    routine_ptr routine;
+    CellOp int_op;
+} _int_ops[] = {
+    {EC_add, OP_INT_ADD},
+    {EC_subtract, OP_INT_SUBTRACT},
+    {EC_multiply, OP_INT_MULTIPLY},
+    {EC_divide, OP_CALL},
+    {EC_mod, OP_CALL},
+    {EC_min, OP_CALL},
+    {EC_max, OP_CALL},
+    {EC_abs, OP_CALL},
+    {EC_negate, OP_CALL},
+    {EC_equal, OP_INT_EQUAL},
+    {EC_not_equal, OP_INT_NOT_EQUAL},
+    {EC_less, OP_INT_LESS},
+    {EC_greater, OP_INT_GREATER},
+    {EC_less_equal, OP_INT_LESS_EQUAL},
+    {EC_greater_equal, OP_INT_GREATER_EQUAL},
+    {EC_not, OP_CALL},
+};
+
+
+
+// -----------------------------------------------------------------------------
+/** Gets the op that replaces a call to a math word in integer code.
+
+\param int_op: Set to the op (OP_CALL if the word has no op of its own)
+
+\returns FALSE if the entry isn't a math word that makes integers from integers
+*/
+// -----------------------------------------------------------------------------
+gboolean get_int_op(const Entry *entry, CellOp *int_op) {
+    for (guint i=0; i < G_N_ELEMENTS(_int_ops); i++) {
+        if (entry->routine == _int_ops[i].routine) {
+            *int_op = _int_ops[i].int_op;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Adds a word that the optimizer can fold (see Entry::pure)
+*/
+// -----------------------------------------------------------------------------
+static void add_pure_entry(const gchar *word, routine_ptr routine, guint num_inputs) {
+    Entry *entry = declare_effect(add_entry(word), num_inputs, 1);
+    entry->pure = 1;
+    entry->routine = routine;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Defines the arithmetic and comparison words
+
+### Arithmetic
+- + (l r -- l+r)
+- - (l r -- l-r)
+- * (l r -- l*r)
+- / (l r -- l/r) Truncates when dividing integers
+- mod (l r -- remainder)
+- min (l r -- min)
+- max (l r -- max)
+- abs (num -- |num|)
+- negate (num -- -num)
+
+### Comparison
+- == (l r -- bool) Values of types that can't be compared are unequal
+- != (l r -- bool)
+- < (l r -- bool) Compares numbers or strings
+- > (l r -- bool)
+- <= (l r -- bool)
+- >= (l r -- bool)
+- not (val -- bool) 1 if val is 0 or ""; 0 otherwise
+*/
+// -----------------------------------------------------------------------------
+void add_math_words() {
+    add_pure_entry("+", EC_add, 2);
+    add_pure_entry("-", EC_subtract, 2);
+    add_pure_entry("*", EC_multiply, 2);
+    declare_effect(add_entry("/"), 2, 1)->routine = EC_divide;
+    declare_effect(add_entry("mod"), 2, 1)->routine = EC_mod;
+    add_pure_entry("min", EC_min, 2);
+    add_pure_entry("max", EC_max, 2);
+    add_pure_entry("abs", EC_abs, 1);
+    add_pure_entry("negate", EC_negate, 1);
+
+    add_pure_entry("==", EC_equal, 2);
+    add_pure_entry("!=", EC_not_equal, 2);
+    add_pure_entry("<", EC_less, 2);
+    add_pure_entry(">", EC_greater, 2);
+    add_pure_entry("<=", EC_less_equal, 2);
+    add_pure_entry(">=", EC_greater_equal, 2);
+    add_pure_entry("not", EC_not, 1);
+}
@@ -0,0 +1,8 @@
+/** \file ec_math.h
+*/
+
+#pragma once
+
+void add_math_words();
+gboolean get_int_op(const Entry *entry, CellOp *int_op);
+gboolean compare_values(const Param *param_l, const Param *param_r, gint *result);
@@ -3,7 +3,7 @@
 \brief Functions for creating, manipulating, executing, and destroying Entry objects.
 
 Entry objects are elements of a Dictionary. When tokens are parsed from input,
-they are looked up in the _dictionary. If a corresponding Entry is found, it
+they are looked up in the dictionary. If a corresponding Entry is found, it
 is executed.
 */
 
@@ -22,74 +22,61 @@ void execute(gpointer gp_entry) {
 
 
 // -----------------------------------------------------------------------------
-/** Compiles a token into the latest Entry's definition.
+/** Compiles a token into the definition (or quotation) being compiled.
+
+See compile_token.
 */
 // -----------------------------------------------------------------------------
 void compile(Token token) {
+    compile_token(compiling_entry(), token);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Compiles a token into an Entry's definition.
+
+Words are compiled into OP_CALL cells and literals into OP_PUSH_LITERAL cells
+that own their literal Param. Immediate words are executed instead.
+
+\param entry_latest: Entry being defined
+\param token: Token to compile
+*/
+// -----------------------------------------------------------------------------
+void compile_token(Entry *entry_latest, Token token) {
     Entry *entry;
-    Entry *entry_latest = latest_entry();
-    Param *param;
-    Entry *pseudo_entry;
-    Param *param_literal;
-    gchar *val_string = NULL;
 
     switch(token.type) {
         case 'W':
             entry = find_entry(token.word);
             if (!entry) {
                 handle_error(ERR_UNKNOWN_WORD);
-                fprintf(stderr, "-----> %s\n", token.word);
+                fprintf(_vm->err, "-----> %s\n", token.word);
                 return;
             }
             else if(entry->immediate) {
                 execute(entry);
             }
             else {
-                param = new_entry_param(entry);
-                add_entry_param(entry_latest, param);
+                add_entry_cell(entry_latest, OP_CALL)->entry = entry;
             }
             break;
 
         case 'I':
-            // Create pseudo entry that pushes an int onto the stack
-            param = new_pseudo_entry_param("push-literal-I", EC_push_param0);
-            pseudo_entry = &param->val_pseudo_entry;
-            param_literal = new_int_param(g_ascii_strtoll(token.word, NULL, 10));
-            add_entry_param(pseudo_entry, param_literal);
-
-            add_entry_param(entry_latest, param);
+            add_entry_cell(entry_latest, OP_PUSH_LITERAL)->literal = new_int_param(token.val_int);
             break;
 
         case 'D':
-            // Create pseudo entry that pushes a double onto the stack
-            param = new_pseudo_entry_param("push-literal-D", EC_push_param0);
-            pseudo_entry = &param->val_pseudo_entry;
-            param_literal = new_double_param(g_ascii_strtod(token.word, NULL));
-            add_entry_param(pseudo_entry, param_literal);
-
-            add_entry_param(entry_latest, param);
+            add_entry_cell(entry_latest, OP_PUSH_LITERAL)->literal = new_double_param(token.val_double);
             break;
 
         case 'S':
-            // Create pseudo entry that pushes a string onto the stack
-            param = new_pseudo_entry_param("push-literal-S", EC_push_param0);
-            pseudo_entry = &param->val_pseudo_entry;
-
-            // Start copying yyext after first '"'...
-            val_string =  g_strdup(yytext+1);
-
-            // ...and NUL out second '"'
-            val_string[yyleng-2] = '\0';
-
-            param_literal = new_str_param(val_string);
-            g_free(val_string);
-            add_entry_param(pseudo_entry, param_literal);
-
-            add_entry_param(entry_latest, param);
+            // Copy the token text between the '"' characters
+            add_entry_cell(entry_latest, OP_PUSH_LITERAL)->literal = new_str_param_len(token.word+1, token.len-2);
             break;
 
         default:
-            printf("TODO: Handle token type: %c\n", token.type);
+            fprintf(_vm->out, "TODO: Handle token type: %c\n", token.type);
             break;
     }
 }
@@ -110,12 +97,39 @@ Entry *new_entry() {
     Entry *result = g_new(Entry, 1);
     result->immediate = 0;
     result->complete = 1;
+    result->parsing = 0;
+    result->pure = 0;
+    result->effect.known = 0;
+    result->effect.num_in = 0;
+    result->effect.num_out = 0;
     result->params = g_sequence_new(free_param);
+    result->code = NULL;
+    result->int_code = NULL;
+    result->dictionary = NULL;
     return result;
 }
 
 
 
+// -----------------------------------------------------------------------------
+/** Declares the stack effect of a primitive: ( num_in -- num_out ).
+
+Definitions that only use words with known effects can be verified when they
+are compiled (see stack_effect.c). Only declare effects that hold whenever the
+routine succeeds.
+
+\returns The entry so this can be chained with add_entry
+*/
+// -----------------------------------------------------------------------------
+Entry *declare_effect(Entry *entry, guint num_in, guint num_out) {
+    entry->effect.known = 1;
+    entry->effect.num_in = num_in;
+    entry->effect.num_out = num_out;
+    return entry;
+}
+
+
+
 // -----------------------------------------------------------------------------
 /** Adds a parameter to an entry.
 
@@ -131,6 +145,124 @@ void add_entry_param(Entry *entry, Param *param) {
 
 
 
+// -----------------------------------------------------------------------------
+/** Appends a cell to an entry's compiled code.
+
+\param entry: Entry being defined
+\param op: Operation of the new cell
+\returns The new cell so its value can be filled in
+
+\note The returned pointer is only valid until the next cell is added since
+      the code array may move as it grows.
+*/
+// -----------------------------------------------------------------------------
+Cell *add_entry_cell(Entry *entry, CellOp op) {
+    if (!entry->code) {
+        entry->code = g_array_new(FALSE, TRUE, sizeof(Cell));
+    }
+
+    Cell cell = {.op = op};
+    g_array_append_val(entry->code, cell);
+    return &g_array_index(entry->code, Cell, entry->code->len - 1);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Prints a cell of a compiled definition.
+*/
+// -----------------------------------------------------------------------------
+void print_cell(FILE *file, const Cell *cell) {
+    switch(cell->op) {
+        case OP_CALL:
+            fprintf(file, "Entry: %s\n", cell->entry->word);
+            break;
+
+        case OP_PUSH_LITERAL:
+            fprintf(file, "Literal: ");
+            print_param(file, cell->literal);
+            break;
+
+        case OP_JMP:
+            fprintf(file, "jmp %+ld\n", cell->jmp_offset);
+            break;
+
+        case OP_JMP_IF_FALSE:
+            fprintf(file, "jmp-if-false %+ld\n", cell->jmp_offset);
+            break;
+
+        case OP_RETURN:
+            fprintf(file, ";\n");
+            break;
+
+        case OP_TAIL_CALL:
+            fprintf(file, "Tail call: %s\n", cell->entry->word);
+            break;
+
+        case OP_DO:
+            fprintf(file, "do %+ld\n", cell->jmp_offset);
+            break;
+
+        case OP_LOOP:
+            fprintf(file, "loop %+ld\n", cell->jmp_offset);
+            break;
+
+        case OP_LOOP_INDEX:
+            fprintf(file, "Loop index: %s\n", cell->loop_level == 0 ? "i" : "j");
+            break;
+
+        case OP_DUP:
+        case OP_SWAP:
+        case OP_DROP:
+            fprintf(file, "Unchecked: %s\n", cell->entry->word);
+            break;
+
+        case OP_INT_LITERAL:
+            fprintf(file, "Int literal: %ld\n", cell->val_int);
+            break;
+
+        case OP_INT_JMP_IF_FALSE:
+            fprintf(file, "int-jmp-if-false %+ld\n", cell->jmp_offset);
+            break;
+
+        case OP_INT_CALL:
+            fprintf(file, "Int call: %s\n", cell->entry->word);
+            break;
+
+        case OP_INT_ADD:
+        case OP_INT_SUBTRACT:
+        case OP_INT_MULTIPLY:
+        case OP_INT_EQUAL:
+        case OP_INT_NOT_EQUAL:
+        case OP_INT_LESS:
+        case OP_INT_GREATER:
+        case OP_INT_LESS_EQUAL:
+        case OP_INT_GREATER_EQUAL:
+            fprintf(file, "Int: %s\n", cell->entry->word);
+            break;
+
+        case OP_LITERAL_CALL:
+            fprintf(file, "Literal+Entry: %s ", cell->entry->word);
+            print_param(file, cell->literal);
+            break;
+
+        case OP_FETCH_VARIABLE:
+            fprintf(file, "Fetch variable: %s\n", cell->entry->word);
+            break;
+
+        case OP_GET_FIELD:
+            fprintf(file, "Get field: ");
+            print_param(file, cell->literal);
+            break;
+
+        default:
+            fprintf(file, "Unknown cell op: %d\n", cell->op);
+            break;
+    }
+}
+
+
+
 // -----------------------------------------------------------------------------
 /** Frees the memory allocated for an Entry
 
@@ -140,5 +272,19 @@ void add_entry_param(Entry *entry, Param *param) {
 void free_entry(gpointer gp_entry) {
     Entry *entry = gp_entry;
     g_sequence_free(entry->params);
+
+    if (entry->code) {
+        for (guint i=0; i < entry->code->len; i++) {
+            Cell *cell = &g_array_index(entry->code, Cell, i);
+            if (cell->literal) free_param(cell->literal);
+        }
+        g_array_free(entry->code, TRUE);
+    }
+
+    // Integer code doesn't own any literals
+    if (entry->int_code) {
+        g_array_free(entry->int_code, TRUE);
+    }
+
     g_free(gp_entry);
 }
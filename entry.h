@@ -6,7 +6,11 @@
 
 
 Entry *new_entry();
+Entry *declare_effect(Entry *entry, guint num_in, guint num_out);
 void add_entry_param(Entry *entry, Param *param);
+Cell *add_entry_cell(Entry *entry, CellOp op);
+void print_cell(FILE *file, const Cell *cell);
 void execute(gpointer entry);
 void compile(Token token);
+void compile_token(Entry *entry_latest, Token token);
 void free_entry(gpointer entry);
@@ -28,7 +28,6 @@ typedef struct {
     struct tm timestamp;                      /**< Timestamp as tm struct */
 } Note;
 
-static Note *_current_start_note = NULL;
 
 
 // -----------------------------------------------------------------------------
@@ -36,7 +35,7 @@ static Note *_current_start_note = NULL;
 */
 // -----------------------------------------------------------------------------
 static Note *copy_note(Note *src) {
-    Note *result = g_new(Note, 1);
+    Note *result = slab_new(Note);
     *result = *src;
     result->note = g_strdup(src->note);
 
@@ -44,7 +43,7 @@ static Note *copy_note(Note *src) {
     struct tm *timestamp = getdate(result->timestamp_text);
     if (!timestamp) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "----->Unable to parse timestamp: getdate_err: %d\n", getdate_err);
+        fprintf(_vm->err, "----->Unable to parse timestamp: getdate_err: %d\n", getdate_err);
     }
     result->timestamp = *timestamp;
     return result;
@@ -59,7 +58,7 @@ static Note *copy_note(Note *src) {
 void free_note(gpointer gp_note) {
     Note *note = gp_note;
     g_free(note->note);
-    g_free(note);
+    slab_delete(Note, note);
 }
 
 
@@ -107,10 +106,10 @@ static void write_elapsed_minutes(gchar *dst, gint64 len, Note *note_l, Note *no
 
 
 static void set_current_start_note(Note *src) {
-    if (_current_start_note) {
-        free_note(_current_start_note);
+    if (_vm->current_start_note) {
+        free_note(_vm->current_start_note);
     }
-    _current_start_note = src ? copy_note(src) : NULL;
+    _vm->current_start_note = src ? copy_note(src) : NULL;
 }
 
 
@@ -121,27 +120,27 @@ static void print_note(FILE *file, Param *param) {
 
     switch(note->type) {
         case 'N':
-            printf("%s - %ld\n%s\n\n", note->timestamp_text, note->id, note->note);
+            fprintf(_vm->out, "%s - %ld\n%s\n\n", note->timestamp_text, note->id, note->note);
             break;
 
         case 'S':
             set_current_start_note(note);
-            printf("\n>> %s - %ld\n%s\n\n", note->timestamp_text, note->id, note->note);
+            fprintf(_vm->out, "\n>> %s - %ld\n%s\n\n", note->timestamp_text, note->id, note->note);
             break;
 
         case 'M':
-            write_elapsed_minutes(elapsed_min_text, MAX_ELAPSED_LEN, note, _current_start_note);
-            printf("(%s min) %s - %ld\n%s\n\n", elapsed_min_text, note->timestamp_text, note->id, note->note);
+            write_elapsed_minutes(elapsed_min_text, MAX_ELAPSED_LEN, note, _vm->current_start_note);
+            fprintf(_vm->out, "(%s min) %s - %ld\n%s\n\n", elapsed_min_text, note->timestamp_text, note->id, note->note);
             break;
 
         case 'E':
-            write_elapsed_minutes(elapsed_min_text, MAX_ELAPSED_LEN, note, _current_start_note);
-            printf("<< (%s min) %s - %ld\n%s\n\n", elapsed_min_text, note->timestamp_text, note->id, note->note);
+            write_elapsed_minutes(elapsed_min_text, MAX_ELAPSED_LEN, note, _vm->current_start_note);
+            fprintf(_vm->out, "<< (%s min) %s - %ld\n%s\n\n", elapsed_min_text, note->timestamp_text, note->id, note->note);
             set_current_start_note(NULL);
             break;
 
         default:
-            printf("TODO: Format this:\n--> %s\n\n", note->note);
+            fprintf(_vm->out, "TODO: Format this:\n--> %s\n\n", note->note);
             break;
     }
 }
@@ -158,6 +157,27 @@ static void print_seq_notes(FILE *file, Param *param) {
 
 
 
+/** \brief Descriptor for Note params
+*/
+static CustomType _note_type = {
+    .name = "Note",
+    .free_custom = free_note,
+    .copy_custom = copy_note_gp,
+    .print = print_note
+};
+
+
+/** \brief Descriptor for sequences of Note params
+*/
+CustomType _note_seq_type = {
+    .name = "[Note]",
+    .free_custom = free_seq,
+    .copy_custom = copy_seq,
+    .print = print_seq_notes
+};
+
+
+
 // -----------------------------------------------------------------------------
 /** Gets a database connection from the "notes-db" variable.
 */
@@ -205,14 +225,14 @@ GSequence *select_notes(const gchar *sql_query) {
     GSequence *result = g_sequence_new(free_param);
     if (error_message) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> Problem executing 'select_notes'\n----->%s", error_message);
+        fprintf(_vm->err, "-----> Problem executing 'select_notes'\n----->%s", error_message);
         goto done;
     }
 
     FOREACH_SEQ(iter, records) {
         GHashTable *record = g_sequence_get(iter);
         Note *note = record_to_note(record);
-        Param *param_new = new_custom_param(note, "Note", free_note, copy_note_gp);
+        Param *param_new = new_custom_param(note, &_note_type);
         g_sequence_append(result, param_new);
     }
 
@@ -242,7 +262,7 @@ static void store_note(const gchar *type) {
 
     if (error_message) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> Problem storing '%s' note ==> %s\n", type, error_message);
+        fprintf(_vm->err, "-----> Problem storing '%s' note ==> %s\n", type, error_message);
     }
 
     free_param(param_note);
@@ -299,7 +319,7 @@ static void EC_notes_today(gpointer gp_entry) {
     snprintf(query, MAX_QUERY_LEN, "%s where date = date('now', 'localtime')", SELECT_NOTES_PHRASE);
 
     GSequence *records = select_notes(query);
-    Param *param_new = new_custom_param(records, "[Note]", free_seq, copy_seq);
+    Param *param_new = new_custom_param(records, &_note_seq_type);
     push_param(param_new);
 }
 
@@ -361,13 +381,13 @@ static void EC_time(gpointer gp_entry) {
     Note *note = get_latest_SE_note();
 
     if (!note) {
-        printf("? min\n");
+        fprintf(_vm->out, "? min\n");
     }
     else {
         time_t start_note_time = mktime(&note->timestamp);
         time_t now = time(NULL);
         gint64 minutes = elapsed_min(now, start_note_time);
-        printf("%ld min\n", minutes);
+        fprintf(_vm->out, "%ld min\n", minutes);
     }
 
     free_note(note);
@@ -394,7 +414,7 @@ static void EC_notes_last_chunk(gpointer gp_entry) {
         free_note(note);
     }
 
-    Param *param_new = new_custom_param(records, "[Note]", free_seq, copy_seq);
+    Param *param_new = new_custom_param(records, &_note_seq_type);
     push_param(param_new);
 }
 
@@ -437,6 +457,6 @@ void EC_add_notes_lexicon(gpointer gp_entry) {
     add_entry("notes-today")->routine = EC_notes_today;
     add_entry("notes-last-chunk")->routine = EC_notes_last_chunk;
 
-    add_print_function("[Note]", print_seq_notes);
-    add_print_function("Note", print_note);
+    add_custom_type(&_note_seq_type);
+    add_custom_type(&_note_type);
 }
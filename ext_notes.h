@@ -3,6 +3,8 @@
 
 #pragma once
 
+extern CustomType _note_seq_type;
+
 void free_note(gpointer gp_note);
 gpointer copy_note_gp(gpointer gp_note);
 GSequence *select_notes(const gchar *sql_query);
@@ -5,21 +5,55 @@
 */
 
 
+/** \brief Descriptor for generic sequences of Params ("[?]")
+
+Lexicons define their own sequence types (e.g., "[Task]") using free_seq and
+copy_seq so they can print them differently.
+*/
+CustomType _sequence_type = {
+    .name = "[?]",
+    .free_custom = free_seq,
+    .copy_custom = copy_seq,
+    .print = print_seq
+};
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns the type for a sequence of items like the specified one.
+
+For a custom item of type "X", this is the registered type named "[X]". If
+there is no such type, the generic sequence type is used.
+*/
+// -----------------------------------------------------------------------------
+static const CustomType *get_seq_type(const Param *item) {
+    if (item->type != 'C') {
+        return &_sequence_type;
+    }
+
+    gchar seq_type_name[MAX_WORD_LEN];
+    snprintf(seq_type_name, MAX_WORD_LEN, "[%s]", item->val_custom_type->name);
+    const CustomType *result = find_custom_type(seq_type_name);
+    return result ? result : &_sequence_type;
+}
+
+
+
 // -----------------------------------------------------------------------------
-/** Helper function to get the value of an object given a word that can extract it.
+/** Helper function to get the value of an object given a block that can extract it.
 
-This pushes the object onto the stack and then executes the word. It then
-pops the value and the object and returns the value.
+This pushes the object onto the stack and then executes the block (a quotation
+or a Forth string). It then pops the value and the object and returns the value.
 
 */
 // -----------------------------------------------------------------------------
-static Param *get_value(gconstpointer gp_param, gchar *sort_word) {
+static Param *get_value(gconstpointer gp_param, const Param *param_block) {
     Param *param = (Param *) gp_param;
 
     COPY_PARAM(param_new, param);
 
     push_param(param_new);                     // (obj -- )
-    execute_string(sort_word);                 // (val -- )
+    execute_block(param_block);                // (val -- )
     Param *result = pop_param();               // ()
     return result;
 }
@@ -28,39 +62,45 @@ static Param *get_value(gconstpointer gp_param, gchar *sort_word) {
 
 // -----------------------------------------------------------------------------
 /** Comparator for generic objects using a sort word (ascending order)
+
+Once there's an error (e.g., the block leaves nothing), the block isn't run
+again, and every item compares equal.
 */
 // -----------------------------------------------------------------------------
-static gint cmp_func(gconstpointer l, gconstpointer r, gpointer gp_word) {
-    gchar *word = gp_word;
-    Param *param_l_val = get_value(l, word);
-    Param *param_r_val = get_value(r, word);
+static gint cmp_func(gconstpointer l, gconstpointer r, gpointer gp_block) {
+    if (_vm->error) return 0;
 
-    gint result = 0;
+    const Param *param_block = gp_block;
+    Param *param_l_val = get_value(l, param_block);
+    Param *param_r_val = _vm->error ? NULL : get_value(r, param_block);
 
-    if (param_l_val->type == 'I') {
-        result = param_l_val->val_int - param_r_val->val_int;
-    }
-    if (param_l_val->type == 'D') {
-        result = param_l_val->val_double - param_r_val->val_double;
-    }
-    else if (param_l_val->type == 'S') {
-        result = g_strcmp0(param_l_val->val_string, param_r_val->val_string);
+    // If the block had an error, it has already been reported
+    gint result = 0;
+    if (!_vm->error && (!param_l_val || !param_r_val)) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        fprintf(_vm->err, "-----> sort's block must leave a value\n");
     }
-    else {
-        fprintf(stderr, "Don't know how to compare '%c'\n", param_l_val->type);
+    else if (!_vm->error && !compare_values(param_l_val, param_r_val, &result)) {
+        gchar type_l = param_l_val->type;
+        gchar type_r = param_r_val->type;
+        handle_error(ERR_INVALID_PARAM);
+        fprintf(_vm->err, "-----> Don't know how to compare '%c' and '%c'\n", type_l, type_r);
     }
 
-    free_param(param_l_val);
-    free_param(param_r_val);
+    if (param_l_val) free_param(param_l_val);
+    if (param_r_val) free_param(param_r_val);
     return result;
 }
 
 
 
 // -----------------------------------------------------------------------------
-/** Sorts a sequence using a word that gets the value from an object
+/** Sorts a sequence using a block that gets the value from an object
 
-(seq sort-word -- seq)
+(seq sort-block -- seq)
+
+The block is a quotation or a Forth string. If it has an error (or leaves values
+that can't be compared), nothing is pushed.
 */
 // ----------------------------------------------------------------------------
 static void EC_sort(gpointer gp_entry) {
@@ -68,10 +108,18 @@ static void EC_sort(gpointer gp_entry) {
     Param *param_word = pop_param();
     Param *param_seq = pop_param();
 
+    // The sequence may be shared (e.g., fetched from a variable), so get our own copy
+    make_custom_writable(param_seq);
     GSequence *sequence = param_seq->val_custom;
 
-    g_sequence_sort(sequence, cmp_func, param_word->val_string);
-    push_param(param_seq);
+    gboolean error_prev = save_error_flag();
+    g_sequence_sort(sequence, cmp_func, param_word);
+    if (restore_error_flag(error_prev)) {
+        free_param(param_seq);
+    }
+    else {
+        push_param(param_seq);
+    }
 
     free_param(param_word);
     return;
@@ -79,10 +127,297 @@ static void EC_sort(gpointer gp_entry) {
 
 
 
+/** \brief An item of a sequence being sorted by psort
+*/
+typedef struct {
+    const Param *key;           /**< \brief Value the block got from the item */
+    guint index;                /**< \brief Position of the item in the sequence (breaks ties) */
+} SortKey;
+
+
+/** \brief A run of sort keys to sort, or two sorted runs to merge
+*/
+typedef struct {
+    SortKey *src;
+    SortKey *dst;               /**< \brief Where merged runs go */
+    guint start;                /**< \brief Start of the (first) run */
+    guint mid;                  /**< \brief Start of the second run */
+    guint end;                  /**< \brief End of the (second) run */
+} SortRun;
+
+
+
+// -----------------------------------------------------------------------------
+/** Checks that a param is a block (a quotation or a Forth string).
+
+Parallel words check their blocks before starting any workers.
+
+\returns FALSE if it isn't (the error has been reported)
+*/
+// -----------------------------------------------------------------------------
+static gboolean check_block(const Param *param_block) {
+    if (param_block->type == 'Q' || param_block->type == 'S') return TRUE;
+
+    handle_error(ERR_INVALID_PARAM);
+    fprintf(_vm->err, "-----> Expected a quotation or a string, not '%c'\n", param_block->type);
+    return FALSE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Checks the arguments of a parallel sequence word: a sequence and a block.
+
+Either param may be NULL if the stack was too short.
+
+\returns FALSE if they're wrong (the error has been reported)
+*/
+// -----------------------------------------------------------------------------
+static gboolean check_seq_args(const Param *param_seq, const Param *param_block) {
+    if (!param_seq || !param_block) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        fprintf(_vm->err, "-----> stack underflow\n");
+        return FALSE;
+    }
+
+    if (param_seq->type != 'C' || param_seq->val_custom_type->free_custom != free_seq) {
+        handle_error(ERR_INVALID_PARAM);
+        fprintf(_vm->err, "-----> Expected a sequence, not '%c'\n", param_seq->type);
+        return FALSE;
+    }
+
+    return check_block(param_block);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Leaves the sort key of each item of a chunk on the stack
+*/
+// -----------------------------------------------------------------------------
+static void get_key_chunk(Param **items, guint num_items, gconstpointer gp_block) {
+    for (guint i=0; i < num_items; i++) {
+        guint depth = get_stack_depth();
+        Param *param_key = get_value(items[i], gp_block);
+        if (_vm->error) {
+            if (param_key) free_param(param_key);
+            return;
+        }
+
+        // There must be exactly one key per item, so drop anything else
+        while (get_stack_depth() > depth) {
+            free_param(pop_param());
+        }
+        if (param_key) push_param(param_key);
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Comparator for sort keys. Ties go to the earlier item, so sorts are stable.
+
+The keys must be comparable (see compare_values).
+*/
+// -----------------------------------------------------------------------------
+static gint compare_sort_keys(gconstpointer gp_l, gconstpointer gp_r) {
+    const SortKey *sort_key_l = gp_l;
+    const SortKey *sort_key_r = gp_r;
+
+    gint result = 0;
+    compare_values(sort_key_l->key, sort_key_r->key, &result);
+    if (result == 0) {
+        result = (sort_key_l->index > sort_key_r->index) - (sort_key_l->index < sort_key_r->index);
+    }
+    return result;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Sorts a run of sort keys in place
+*/
+// -----------------------------------------------------------------------------
+static void sort_run(gpointer gp_run) {
+    SortRun *run = gp_run;
+    qsort(run->src + run->start, run->end - run->start, sizeof(SortKey), compare_sort_keys);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Merges two sorted runs from src into dst
+*/
+// -----------------------------------------------------------------------------
+static void merge_runs(gpointer gp_run) {
+    SortRun *run = gp_run;
+    guint i = run->start;
+    guint j = run->mid;
+    guint k = run->start;
+
+    while (i < run->mid && j < run->end) {
+        if (compare_sort_keys(&run->src[j], &run->src[i]) < 0) {
+            run->dst[k++] = run->src[j++];
+        }
+        else {
+            run->dst[k++] = run->src[i++];
+        }
+    }
+    while (i < run->mid) run->dst[k++] = run->src[i++];
+    while (j < run->end) run->dst[k++] = run->src[j++];
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Sorts keys on the worker threads.
+
+The keys are split into one run per worker, and the runs are sorted at the
+same time. Pairs of runs are then merged (also at the same time) until there's
+only one run left.
+
+\returns The sorted keys: either keys or buffer
+*/
+// -----------------------------------------------------------------------------
+static SortKey *sort_keys(SortKey *keys, SortKey *buffer, guint num_keys) {
+    if (num_keys == 0) return keys;
+
+    guint num_runs = MIN(get_num_workers(), num_keys);
+    guint run_size = (num_keys + num_runs - 1) / num_runs;
+    num_runs = (num_keys + run_size - 1) / run_size;
+
+    SortRun *runs = g_new(SortRun, num_runs);
+    gpointer *jobs = g_new(gpointer, num_runs);
+    for (guint i=0; i < num_runs; i++) {
+        runs[i].src = keys;
+        runs[i].start = i * run_size;
+        runs[i].end = MIN(num_keys, (i + 1) * run_size);
+        jobs[i] = &runs[i];
+    }
+    run_in_workers(sort_run, jobs, num_runs);
+
+    // Each pass merges pairs of runs, going back and forth between the arrays
+    SortKey *src = keys;
+    SortKey *dst = buffer;
+    while (num_runs > 1) {
+        guint num_merged = (num_runs + 1) / 2;
+        for (guint i=0; i < num_merged; i++) {
+            SortRun *run_l = &runs[2*i];
+            SortRun *run_r = 2*i + 1 < num_runs ? &runs[2*i + 1] : run_l;
+
+            SortRun merged = {src, dst, run_l->start, run_l->end, run_r->end};
+            runs[i] = merged;
+            jobs[i] = &runs[i];
+        }
+        run_in_workers(merge_runs, jobs, num_merged);
+
+        num_runs = num_merged;
+        SortKey *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    g_free(jobs);
+    g_free(runs);
+    return src;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Sorts a sequence on the worker threads using a block that gets the value
+    from an object (see parallel.c)
+
+(seq sort-block -- seq)
+
+Like sort, but the block runs only once per item, in child interpreters, so it
+can't store in the caller's variables. The keys are then sorted and merged on the worker
+threads. Items with equal keys stay in the same order.
+
+All of the keys must be numbers, or all of them must be strings.
+*/
+// -----------------------------------------------------------------------------
+static void EC_psort(gpointer gp_entry) {
+    Param *param_block = pop_param();
+    Param *param_seq = pop_param();
+    if (!check_seq_args(param_seq, param_block)) {
+        free_param(param_block);
+        free_param(param_seq);
+        return;
+    }
+
+    GSequence *seq = param_seq->val_custom;
+    guint num_items = g_sequence_get_length(seq);
+    GPtrArray *param_keys = run_chunks(seq, get_key_chunk, param_block);
+    free_param(param_block);
+
+    if (!param_keys) {
+        free_param(param_seq);
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> psort's block failed\n");
+        return;
+    }
+
+    if (param_keys->len != num_items) {
+        g_ptr_array_free(param_keys, TRUE);
+        free_param(param_seq);
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> psort's block must leave a value for each item\n");
+        return;
+    }
+
+    // Check the keys up front so the comparisons can't fail
+    for (guint i=1; i < num_items; i++) {
+        const Param *param_key_0 = g_ptr_array_index(param_keys, 0);
+        const Param *param_key_i = g_ptr_array_index(param_keys, i);
+        gint cmp;
+        if (!compare_values(param_key_0, param_key_i, &cmp)) {
+            gchar type_0 = param_key_0->type;
+            gchar type_i = param_key_i->type;
+            g_ptr_array_free(param_keys, TRUE);
+            free_param(param_seq);
+            handle_error(ERR_INVALID_PARAM);
+            fprintf(_vm->err, "-----> Can't sort '%c' and '%c' keys together\n", type_0, type_i);
+            return;
+        }
+    }
+
+    Param **items = g_new(Param *, num_items);
+    SortKey *keys = g_new(SortKey, num_items);
+    guint index = 0;
+    FOREACH_SEQ(iter, seq) {
+        items[index] = g_sequence_get(iter);
+        keys[index].key = g_ptr_array_index(param_keys, index);
+        keys[index].index = index;
+        index++;
+    }
+
+    SortKey *buffer = g_new(SortKey, num_items);
+    SortKey *sorted = sort_keys(keys, buffer, num_items);
+
+    GSequence *result = g_sequence_new(free_param);
+    for (guint i=0; i < num_items; i++) {
+        COPY_PARAM(param_new, items[sorted[i].index]);
+        g_sequence_append(result, param_new);
+    }
+    push_param(new_custom_param(result, param_seq->val_custom_type));
+
+    g_free(buffer);
+    g_free(keys);
+    g_free(items);
+    g_ptr_array_free(param_keys, TRUE);
+    free_param(param_seq);
+}
+
+
+
 // -----------------------------------------------------------------------------
-/** Sorts a sequence using a word that gets the value from an object
+/** Filters a sequence using a block that returns a boolean for an object
 
-(seq forth-string -- seq)
+(seq block -- seq)
+
+The block is a quotation or a Forth string. If it has an error, filtering stops
+and nothing is pushed.
 */
 // ----------------------------------------------------------------------------
 static void EC_filter(gpointer gp_entry) {
@@ -92,20 +427,40 @@ static void EC_filter(gpointer gp_entry) {
     GSequence *seq = param_seq->val_custom;
 
     GSequence *filtered_seq = g_sequence_new(free_param);
-    gchar seq_type[MAX_WORD_LEN] = "[?]";
+    const CustomType *seq_type = &_sequence_type;
+    if (g_sequence_get_length(seq) > 0) {
+        seq_type = get_seq_type(g_sequence_get(g_sequence_get_begin_iter(seq)));
+    }
 
+    gboolean error_prev = save_error_flag();
     FOREACH_SEQ(iter, seq) {
         Param *item = g_sequence_get(iter);
-        snprintf(seq_type, MAX_WORD_LEN, "[%s]", item->val_custom_type);  // Yeah, we should just set it once
-        Param *param_val = get_value(item, param_forth->val_string);
-        if (param_val->val_int) {
+        guint depth = get_stack_depth();
+        Param *param_val = get_value(item, param_forth);
+        if (_vm->error) {
+            if (param_val) free_param(param_val);
+            break;
+        }
+        if (!param_val) continue;
+
+        // Only the block's last value counts, so drop anything else it left
+        while (get_stack_depth() > depth) {
+            free_param(pop_param());
+        }
+
+        if (is_true_param(param_val)) {
             COPY_PARAM(param_new, item);
             g_sequence_append(filtered_seq, param_new);
         }
         free_param(param_val);
     }
 
-    push_param(new_custom_param(filtered_seq, seq_type, free_seq, copy_seq));
+    if (restore_error_flag(error_prev)) {
+        g_sequence_free(filtered_seq);
+    }
+    else {
+        push_param(new_custom_param(filtered_seq, seq_type));
+    }
 
     free_param(param_forth);
     free_param(param_seq);
@@ -113,6 +468,137 @@ static void EC_filter(gpointer gp_entry) {
 
 
 
+// -----------------------------------------------------------------------------
+/** Maps a block over a chunk of items, leaving its results on the stack
+*/
+// -----------------------------------------------------------------------------
+static void map_chunk(Param **items, guint num_items, gconstpointer gp_block) {
+    for (guint i=0; i < num_items; i++) {
+        COPY_PARAM(param_new, items[i]);
+        push_param(param_new);
+        execute_block(gp_block);    // This will consume param
+        if (_vm->error) return;
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Leaves the items of a chunk that a block returns true for on the stack
+*/
+// -----------------------------------------------------------------------------
+static void filter_chunk(Param **items, guint num_items, gconstpointer gp_block) {
+    for (guint i=0; i < num_items; i++) {
+        guint depth = get_stack_depth();
+        Param *param_val = get_value(items[i], gp_block);
+        if (_vm->error) {
+            if (param_val) free_param(param_val);
+            return;
+        }
+        if (!param_val) continue;
+
+        // Only kept items are results, so drop anything else the block left
+        while (get_stack_depth() > depth) {
+            free_param(pop_param());
+        }
+
+        if (is_true_param(param_val)) {
+            COPY_PARAM(param_new, items[i]);
+            push_param(param_new);
+        }
+        free_param(param_val);
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Moves an array of params into a new sequence param
+*/
+// -----------------------------------------------------------------------------
+static Param *new_seq_param(GPtrArray *params, const CustomType *seq_type) {
+    GSequence *seq = g_sequence_new(free_param);
+    for (guint i=0; i < params->len; i++) {
+        g_sequence_append(seq, g_ptr_array_index(params, i));
+    }
+    g_ptr_array_set_free_func(params, NULL);
+    g_ptr_array_free(params, TRUE);
+
+    return new_custom_param(seq, seq_type);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Maps a block over a seq on the worker threads (see parallel.c)
+
+(seq-in block -- seq-out)
+
+Like map, but chunks of the sequence are mapped at the same time in child
+interpreters, so the block can't store in the caller's variables.
+*/
+// -----------------------------------------------------------------------------
+static void EC_pmap(gpointer gp_entry) {
+    Param *param_block = pop_param();
+    Param *param_seq = pop_param();
+    if (!check_seq_args(param_seq, param_block)) {
+        free_param(param_block);
+        free_param(param_seq);
+        return;
+    }
+
+    GPtrArray *results = run_chunks(param_seq->val_custom, map_chunk, param_block);
+    free_param(param_block);
+    free_param(param_seq);
+
+    if (!results) {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> pmap's block failed\n");
+        return;
+    }
+    push_param(new_seq_param(results, &_sequence_type));
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Filters a seq on the worker threads (see parallel.c)
+
+(seq block -- seq)
+
+Like filter, but chunks of the sequence are filtered at the same time in child
+interpreters, so the block can't store in the caller's variables.
+*/
+// -----------------------------------------------------------------------------
+static void EC_pfilter(gpointer gp_entry) {
+    Param *param_block = pop_param();
+    Param *param_seq = pop_param();
+    if (!check_seq_args(param_seq, param_block)) {
+        free_param(param_block);
+        free_param(param_seq);
+        return;
+    }
+
+    GSequence *seq = param_seq->val_custom;
+    const CustomType *seq_type = &_sequence_type;
+    if (g_sequence_get_length(seq) > 0) {
+        seq_type = get_seq_type(g_sequence_get(g_sequence_get_begin_iter(seq)));
+    }
+
+    GPtrArray *results = run_chunks(seq, filter_chunk, param_block);
+    free_param(param_block);
+    free_param(param_seq);
+
+    if (!results) {
+        handle_error(ERR_GENERIC_ERROR);
+        fprintf(_vm->err, "-----> pfilter's block failed\n");
+        return;
+    }
+    push_param(new_seq_param(results, seq_type));
+}
+
+
+
 /** Concatenate a sequence of sequences
 
 ([Sequence] -- Sequence)
@@ -122,11 +608,11 @@ static void EC_concat(gpointer gp_entry) {
     GSequence *seq_seq = param_seq_seq->val_custom;
 
     GSequence *result = g_sequence_new(free_param);
-    gchar seq_type[MAX_WORD_LEN];
+    const CustomType *seq_type = &_sequence_type;
     FOREACH_SEQ(iter, seq_seq) {
         Param *param_seq = g_sequence_get(iter);
         GSequence *seq = param_seq->val_custom;
-        g_strlcpy(seq_type, param_seq->val_custom_type, MAX_WORD_LEN);  // Yeah, only need to do this once...
+        seq_type = param_seq->val_custom_type;
 
         for (GSequenceIter *jiter = g_sequence_get_begin_iter(seq);
              !g_sequence_iter_is_end(jiter);
@@ -138,7 +624,7 @@ static void EC_concat(gpointer gp_entry) {
         }
     }
 
-    push_param(new_custom_param(result, seq_type, free_seq, copy_seq));
+    push_param(new_custom_param(result, seq_type));
 
     free_param(param_seq_seq);
 }
@@ -197,7 +683,7 @@ static void EC_end_seq(gpointer gp_entry) {
     Param *param = pop_param();
     if (!param) {
         handle_error(ERR_STACK_UNDERFLOW);
-        fprintf(stderr, "-----> stack underflow\n");
+        fprintf(_vm->err, "-----> stack underflow\n");
         return;
     }
     GSequence *seq = g_sequence_new(free_param);
@@ -206,24 +692,25 @@ static void EC_end_seq(gpointer gp_entry) {
         param = pop_param();
         if (!param) {
             handle_error(ERR_STACK_UNDERFLOW);
-            fprintf(stderr, "-----> stack underflow\n");
+            fprintf(_vm->err, "-----> stack underflow\n");
             return;
         }
     }
     free_param(param);  // This will be the '[' param
 
-    Param *param_new = new_custom_param(seq, "[?]", free_seq, copy_seq);
+    Param *param_new = new_custom_param(seq, &_sequence_type);
     push_param(param_new);
 }
 
 
 
-/** Maps a word over a seq
+/** Maps a block over a seq
 
-The word should pop a param, freeing it when done, and then pushing
-a new value onto the stack.
+The block (a quotation or a Forth string) should pop a param, freeing it when
+done, and then pushing a new value onto the stack. If it has an error, mapping
+stops and nothing is pushed.
 
-(seq-in word -- seq-out)
+(seq-in block -- seq-out)
 */
 static void EC_map(gpointer gp_entry) {
     Param *param_word = pop_param();
@@ -231,16 +718,20 @@ static void EC_map(gpointer gp_entry) {
     Param *param_seq = pop_param();
     GSequence *seq = param_seq->val_custom;
 
+    gboolean error_prev = save_error_flag();
     execute_string("[");
 
     FOREACH_SEQ(iter, seq) {
         Param *param = g_sequence_get(iter);
         COPY_PARAM(param_new, param);
         push_param(param_new);
-        execute_string(param_word->val_string);  // This will consume param
+        execute_block(param_word);  // This will consume param
+        if (_vm->error) break;
     }
 
-    execute_string("]");
+    // The error cleared the stack, including the start of the sequence
+    if (!_vm->error) execute_string("]");
+    restore_error_flag(error_prev);
 
     free_param(param_word);
     free_param(param_seq);
@@ -250,7 +741,7 @@ static void EC_map(gpointer gp_entry) {
 void print_seq(FILE *file, Param *param) {
     GSequence *sequence = param->val_custom;
 
-    fprintf(file, "Sequence: %s\n", param->val_custom_type);
+    fprintf(file, "Sequence: %s\n", param->val_custom_type->name);
     FOREACH_SEQ(iter, sequence) {
         Param *p = g_sequence_get(iter);
         fprintf(file, "    ");
@@ -271,12 +762,15 @@ void EC_add_sequence_lexicon(gpointer gp_entry) {
     add_entry("[")->routine = EC_start_seq;
     add_entry("]")->routine = EC_end_seq;
 
-    add_entry("len")->routine = EC_len;
+    declare_effect(add_entry("len"), 1, 2)->routine = EC_len;
     add_entry("map")->routine = EC_map;
     add_entry("sort")->routine = EC_sort;
     add_entry("filter")->routine = EC_filter;
+    declare_effect(add_entry("pmap"), 2, 1)->routine = EC_pmap;
+    declare_effect(add_entry("pfilter"), 2, 1)->routine = EC_pfilter;
+    declare_effect(add_entry("psort"), 2, 1)->routine = EC_psort;
 
     add_entry("concat")->routine = EC_concat;
 
-    add_print_function("[?]", print_seq);
+    add_custom_type(&_sequence_type);
 }
@@ -3,6 +3,8 @@
 
 #pragma once
 
+extern CustomType _sequence_type;
+
 void EC_add_sequence_lexicon(gpointer gp_entry);
 void print_seq(FILE *file, Param *param);
 void free_seq(gpointer gp_seq);
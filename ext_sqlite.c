@@ -36,6 +36,16 @@ GSequence *sql_select(sqlite3* connection, const gchar *query, gchar **error_mes
     return result;
 }
 
+/** \brief Descriptor for sqlite3 connection params (closed by sqlite3-close, not when freed)
+*/
+static CustomType _connection_type = {
+    .name = "sqlite3*",
+    .free_custom = free_nop,
+    .copy_custom = copy_nop
+};
+
+
+
 // -----------------------------------------------------------------------------
 /** Pops a db filename, opens an sqlite3 connection to it, and pushes the
 connection onto the stack.
@@ -49,10 +59,10 @@ static void EC_sqlite3_open(gpointer gp_entry) {
     int sqlite_status = sqlite3_open(db_file->val_string, &connection);
     if (sqlite_status != SQLITE_OK) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> sqlite3_open failed\n");
+        fprintf(_vm->err, "-----> sqlite3_open failed\n");
         return;
     }
-    Param *param_new = new_custom_param(connection, "sqlite3*", free_nop, copy_nop);
+    Param *param_new = new_custom_param(connection, &_connection_type);
     push_param(param_new);
 
     free_param(db_file);
@@ -72,7 +82,7 @@ static void EC_sqlite3_close(gpointer gp_entry) {
     int sqlite_status = sqlite3_close(connection);
     if (sqlite_status != SQLITE_OK) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> sqlite3_close failed\n");
+        fprintf(_vm->err, "-----> sqlite3_close failed\n");
         return;
     }
 
@@ -115,4 +125,6 @@ void EC_add_sqlite_lexicon(gpointer gp_entry) {
     add_entry("sqlite3-open")->routine = EC_sqlite3_open;
     add_entry("sqlite3-close")->routine = EC_sqlite3_close;
     add_entry("sqlite3-last-id")->routine = EC_sqlite3_last_id;
+
+    add_custom_type(&_connection_type);
 }
@@ -65,7 +65,7 @@ static sqlite3 *get_db_connection() {
 static Task *copy_task(Task *src) {
     if (!src) return NULL;
 
-    Task *result = g_new(Task, 1);
+    Task *result = slab_new(Task);
     *result = *src;
     return result;
 }
@@ -77,9 +77,37 @@ static gpointer copy_task_gp(gpointer src) {
 
 
 static void free_task(gpointer gp_task) {
-    g_free(gp_task);
+    slab_delete(Task, gp_task);
 }
 
+
+static void print_task(FILE *file, Param *param);
+static void print_seq_tasks(FILE *file, Param *param);
+static Param *get_task_field(const Param *param_task, const gchar *field_name);
+static gboolean set_task_field(const Param *param_task, const gchar *field_name, const Param *param_value);
+
+
+/** \brief Descriptor for Task params
+*/
+static CustomType _task_type = {
+    .name = "Task",
+    .free_custom = free_task,
+    .copy_custom = copy_task_gp,
+    .print = print_task,
+    .get_field = get_task_field,
+    .set_field = set_task_field
+};
+
+
+/** \brief Descriptor for sequences of Task params
+*/
+static CustomType _task_seq_type = {
+    .name = "[Task]",
+    .free_custom = free_seq,
+    .copy_custom = copy_seq,
+    .print = print_seq_tasks
+};
+
 // -----------------------------------------------------------------------------
 /** Adds a task to the tasks-db
 */
@@ -96,7 +124,7 @@ static void add_task(const gchar *name, gint64 parent_id) {
 
     if (error_message) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> Problem storing task '%s' ==> %s\n", name, error_message);
+        fprintf(_vm->err, "-----> Problem storing task '%s' ==> %s\n", name, error_message);
     }
 
     gint64 task_id = sqlite3_last_insert_rowid(connection);
@@ -109,7 +137,7 @@ static void add_task(const gchar *name, gint64 parent_id) {
 
     if (error_message) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> Problem adding parent (%ld) child (%ld) ==> %s\n", parent_id, task_id, error_message);
+        fprintf(_vm->err, "-----> Problem adding parent (%ld) child (%ld) ==> %s\n", parent_id, task_id, error_message);
     }
 }
 
@@ -156,14 +184,14 @@ static GSequence *select_tasks(const gchar *sql_query) {
     GSequence *result = g_sequence_new(free_param);
     if (error_message) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> Problem executing 'select_tasks'\n----->%s", error_message);
+        fprintf(_vm->err, "-----> Problem executing 'select_tasks'\n----->%s", error_message);
         goto done;
     }
 
     FOREACH_SEQ(iter, records) {
         GHashTable *record = g_sequence_get(iter);
         Task *task = record_to_task(record);
-        Param *param_new = new_custom_param(task, "Task", free_task, copy_task_gp);
+        Param *param_new = new_custom_param(task, &_task_type);
         g_sequence_append(result, param_new);
     }
 
@@ -233,7 +261,7 @@ static void EC_link_note(gpointer gp_entry) {
 
     if (error_message) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> Problem executing 'link-note'\n----->%s", error_message);
+        fprintf(_vm->err, "-----> Problem executing 'link-note'\n----->%s", error_message);
     }
 }
 
@@ -266,14 +294,14 @@ static void EC_get_task(gpointer gp_entry) {
 
     if (param_id->val_int == 0) {
         task = copy_task(&_root_task);
-        push_param(new_custom_param(task, "Task", free_task, copy_task_gp));
+        push_param(new_custom_param(task, &_task_type));
     }
     else {
         snprintf(query, MAX_QUERY_LEN, "%s where id = %ld", SELECT_TASKS_PHRASE, param_id->val_int);
         records = select_tasks(query);
         if (g_sequence_get_length(records) != 1) {
             handle_error(ERR_GENERIC_ERROR);
-            fprintf(stderr, "-----> Problem executing 'get_task'\n");
+            fprintf(_vm->err, "-----> Problem executing 'get_task'\n");
             goto done;
         }
         Param *param_task = g_sequence_get(g_sequence_get_begin_iter(records));
@@ -306,7 +334,7 @@ static void EC_last_active_task(gpointer gp_entry) {
     }
     else {
         Task *task = copy_task(&_root_task);
-        push_param(new_custom_param(task, "Task", free_task, copy_task_gp));
+        push_param(new_custom_param(task, &_task_type));
     }
 
     g_sequence_free(records);
@@ -358,7 +386,7 @@ static void EC_add_subtask(gpointer gp_entry) {
 */
 static void EC_all(gpointer gp_entry) {
     GSequence *records = select_tasks(SELECT_TASKS_PHRASE);
-    push_param(new_custom_param(records, "[Task]", free_seq, copy_seq));
+    push_param(new_custom_param(records, &_task_seq_type));
 }
 
 
@@ -375,80 +403,61 @@ static GSequence *get_task_notes(gint64 task_id) {
 }
 
 
-/**
-(Task field-name -- value)
+// -----------------------------------------------------------------------------
+/** Returns a new Param with the value of a Task field (or NULL if no such field)
 */
-static void EC_get_field(gpointer gp_entry) {
-    Param *param_field_name = pop_param();
-    Param *param_task = pop_param();
-    Task *task = param_task->val_custom;
-
-    gchar *field_name = param_field_name->val_string;
+// -----------------------------------------------------------------------------
+static Param *get_task_field(const Param *param_task, const gchar *field_name) {
+    const Task *task = param_task->val_custom;
 
     if (STR_EQ(field_name, "id")) {
-        push_param(new_int_param(task->id));
+        return new_int_param(task->id);
     }
     else if (STR_EQ(field_name, "parent_id")) {
-        push_param(new_int_param(task->parent_id));
+        return new_int_param(task->parent_id);
     }
     else if (STR_EQ(field_name, "is_done")) {
-        push_param(new_int_param(task->is_done));
+        return new_int_param(task->is_done);
     }
     else if (STR_EQ(field_name, "value")) {
-        push_param(new_double_param(task->value));
+        return new_double_param(task->value);
     }
     else if (STR_EQ(field_name, "notes")) {
-        push_param(new_custom_param(get_task_notes(task->id), "[Note]", free_seq, copy_seq));
+        return new_custom_param(get_task_notes(task->id), &_note_seq_type);
     }
-    else {
-        handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> Unknown Task field: %s\n", field_name);
-    }
-
-    free_param(param_field_name);
-    free_param(param_task);
+    return NULL;
 }
 
-/**
-(Task value field-name -- )
+
+
+// -----------------------------------------------------------------------------
+/** Updates a Task field in the database (returns FALSE if no such field)
 */
-static void EC_set_field(gpointer gp_entry) {
-    Param *param_field_name = pop_param();
-    Param *param_value = pop_param();
-    Param *param_task = pop_param();
+// -----------------------------------------------------------------------------
+static gboolean set_task_field(const Param *param_task, const gchar *field_name, const Param *param_value) {
     gchar query[MAX_QUERY_LEN];
 
-    Task *task = param_task->val_custom;
-    gchar *field_name = param_field_name->val_string;
-
-    sqlite3 *connection = get_db_connection();
-    const gchar *error_message = NULL;
+    const Task *task = param_task->val_custom;
 
     if (STR_EQ(field_name, "parent_id")) {
         snprintf(query, MAX_QUERY_LEN, "update parent_child set parent_id=%ld where child_id=%ld", param_value->val_int, task->id);
-        error_message = sql_execute(connection, query);
     }
     else if (STR_EQ(field_name, "is_done")) {
         snprintf(query, MAX_QUERY_LEN, "update tasks set is_done=%ld where id=%ld", param_value->val_int, task->id);
-        error_message = sql_execute(connection, query);
     }
     else if (STR_EQ(field_name, "value")) {
         snprintf(query, MAX_QUERY_LEN, "update tasks set value=%lf where id=%ld", param_value->val_double, task->id);
-        error_message = sql_execute(connection, query);
     }
     else {
-        handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "-----> Unknown Task field: %s\n", field_name);
+        return FALSE;
     }
 
+    const gchar *error_message = sql_execute(get_db_connection(), query);
     if (error_message) {
         handle_error(ERR_GENERIC_ERROR);
-        fprintf(stderr, "----> Problem in EC_set_field: '%s'\n", error_message);
+        fprintf(_vm->err, "----> Problem in set_task_field: '%s'\n", error_message);
     }
-
-    free_param(param_field_name);
-    free_param(param_value);
-    free_param(param_task);
+    return TRUE;
 }
 
 
@@ -502,7 +511,7 @@ static void EC_descendants(gpointer gp_entry) {
         g_sequence_free(subtasks);
     }
 
-    push_param(new_custom_param(result, "[Task]", free_seq, copy_seq));
+    push_param(new_custom_param(result, &_task_seq_type));
 
     // Cleanup
     g_queue_free(queue);
@@ -518,7 +527,7 @@ static void EC_ancestors(gpointer gp_entry) {
     Param *param_task = pop_param();  // We won't free this since we'll put it in the result
     Task *task = param_task->val_custom;
 
-    GSequence *result = g_sequence_new(g_free);
+    GSequence *result = g_sequence_new(free_param);
     g_sequence_append(result, param_task);
     while (task->id != 0) {
         snprintf(query, MAX_QUERY_LEN, "%s where id=%ld", SELECT_TASKS_PHRASE, task->parent_id);
@@ -536,7 +545,7 @@ static void EC_ancestors(gpointer gp_entry) {
         g_sequence_free(tasks);
     }
 
-    Param *param_result = new_custom_param(result, "[Task]", free_seq, copy_seq);
+    Param *param_result = new_custom_param(result, &_task_seq_type);
     push_param(param_result);
 }
 
@@ -555,7 +564,7 @@ static void EC_search(gpointer gp_entry) {
     free_param(param_search);
     GSequence *tasks = select_tasks(query);
 
-    Param *param_result = new_custom_param(tasks, "[Task]", free_seq, copy_seq);
+    Param *param_result = new_custom_param(tasks, &_task_seq_type);
     push_param(param_result);
 }
 
@@ -591,10 +600,10 @@ void EC_add_tasks_lexicon(gpointer gp_entry) {
     add_variable("cur-task-id");
     set_cur_task_id(0);
 
-    add_entry("all")->routine = EC_all;
+    declare_effect(add_entry("all"), 0, 1)->routine = EC_all;
     add_entry("ancestors")->routine = EC_ancestors;
     add_entry("descendants")->routine = EC_descendants;
-    add_entry("T")->routine = EC_get_task;
+    declare_effect(add_entry("T"), 1, 1)->routine = EC_get_task;
     add_entry("last-active-task")->routine = EC_last_active_task;
     add_entry("search")->routine = EC_search;
 
@@ -602,12 +611,8 @@ void EC_add_tasks_lexicon(gpointer gp_entry) {
 
     add_entry("link-note")->routine = EC_link_note;
 
-    // TODO: Make these general like "."
-    add_entry("@field")->routine = EC_get_field;
-    add_entry("!field")->routine = EC_set_field;
-
-    add_print_function("[Task]", print_seq_tasks);
-    add_print_function("Task", print_task);
+    add_custom_type(&_task_seq_type);
+    add_custom_type(&_task_type);
 
     // Consider moving these to a single function
     define_open_db();
@@ -8,14 +8,12 @@
 #define TREE_HORIZ   "─"
 
 
-#define MAX_FIELD_LEN  80
-
 typedef struct {
     GSequence *root_items;
     GHashTable *children;    /**< \brief Maps parent ID to sequence of children */
 
-    gchar id_field[MAX_FIELD_LEN];
-    gchar parent_id_field[MAX_FIELD_LEN];
+    Param *id_field;         /**< \brief Field name or quotation that gets an item's ID */
+    Param *parent_id_field;  /**< \brief Field name or quotation that gets an item's parent ID */
 } Forest;
 
 
@@ -41,6 +39,11 @@ static Forest *copy_forest(Forest *src) {
     Forest *result = g_new(Forest, 1);
     *result = *src;
 
+    result->id_field = new_param();
+    copy_param(result->id_field, src->id_field);
+    result->parent_id_field = new_param();
+    copy_param(result->parent_id_field, src->parent_id_field);
+
     // Copy root items
     result->root_items = g_sequence_new(free_param);
     FOREACH_SEQ(iter, src->root_items) {
@@ -75,21 +78,54 @@ static void free_forest(gpointer gp_forest) {
     g_sequence_free(forest->root_items);
     g_hash_table_foreach(forest->children, free_forest_entry, NULL);
     g_hash_table_destroy(forest->children);
+    free_param(forest->id_field);
+    free_param(forest->parent_id_field);
     g_free(forest);
 }
 
 
+static void print_forest(FILE *file, Param *param);
+
+
+/** \brief Descriptor for Forest params
+*/
+static CustomType _forest_type = {
+    .name = "Forest",
+    .free_custom = free_forest,
+    .copy_custom = copy_forest_gp,
+    .print = print_forest
+};
+
+
 
-gchar *get_id(const gchar *id_field, Param *param) {
-    gchar forth_string[MAX_FORTH_LEN];
-    snprintf(forth_string, MAX_FORTH_LEN, "'%s' @field", id_field);
+// -----------------------------------------------------------------------------
+/** Returns an item's ID as a newly allocated string.
 
+\param id_field: Name of the ID field or a quotation that gets the ID (obj -- val)
+\param param: Item to get the ID of
+\returns NULL if the ID can't be gotten, e.g., the block left nothing or a double
+         (the error is handled here)
+*/
+// -----------------------------------------------------------------------------
+gchar *get_id(const Param *id_field, Param *param) {
     // Extract id from object
     COPY_PARAM(param_new, param);
-
     push_param(param_new);          // (obj -- )
-    execute_string(forth_string);   // (val --)
+
+    if (id_field->type == 'Q') {
+        execute_block(id_field);        // (val --)
+    }
+    else {
+        gchar forth_string[MAX_FORTH_LEN];
+        snprintf(forth_string, MAX_FORTH_LEN, "'%s' @field", id_field->val_string);
+        execute_string(forth_string);   // (val --)
+    }
     Param *param_val = pop_param(); // ( -- )
+    if (!param_val) {
+        handle_error(ERR_STACK_UNDERFLOW);
+        fprintf(_vm->err, "-----> Getting an id left nothing on the stack\n");
+        return NULL;
+    }
 
     // Construct result
     gchar *result = NULL;
@@ -106,7 +142,7 @@ gchar *get_id(const gchar *id_field, Param *param) {
 
         default:
             handle_error(ERR_GENERIC_ERROR);
-            fprintf(stderr, "-----> Unknown id type: '%c'\n", param_val->type);
+            fprintf(_vm->err, "-----> Unknown id type: '%c'\n", param_val->type);
             break;
     }
     free_param(param_val);
@@ -116,8 +152,8 @@ gchar *get_id(const gchar *id_field, Param *param) {
 
 typedef struct {
     GHashTable *item_order;
-    const gchar *id_field;
-    const gchar *parent_id_field;
+    const Param *id_field;
+    const Param *parent_id_field;
 } ItemOrderInfo;
 
 
@@ -135,8 +171,8 @@ gint compare_item_order(gconstpointer l, gconstpointer r, gpointer gp_item_order
 
     gchar *l_item_id = get_id(order_info->id_field, (Param *) l_param);
     gchar *r_item_id = get_id(order_info->id_field, (Param *) r_param);
-    gint64 l_val = (gint64) g_hash_table_lookup(item_order_hash, (gpointer) l_item_id);
-    gint64 r_val = (gint64) g_hash_table_lookup(item_order_hash, (gpointer) r_item_id);
+    gint64 l_val = l_item_id ? (gint64) g_hash_table_lookup(item_order_hash, (gpointer) l_item_id) : 0;
+    gint64 r_val = r_item_id ? (gint64) g_hash_table_lookup(item_order_hash, (gpointer) r_item_id) : 0;
 
     g_free(l_item_id);
     g_free(r_item_id);
@@ -147,18 +183,24 @@ gint compare_item_order(gconstpointer l, gconstpointer r, gpointer gp_item_order
 
 /** Converts a sequence to a forest
 (sequence id-field parent-id-field -- forest)
+
+The ID fields are field names or quotations that get the ID from an item. If an
+item's ID can't be gotten, nothing is pushed.
 */
 static void EC_forest(gpointer gp_entry) {
     Param *param_parent_id_field = pop_param();
     Param *param_id_field = pop_param();
     Param *param_sequence = pop_param();
 
-    const gchar *parent_id_field = param_parent_id_field->val_string;
-    const gchar *id_field = param_id_field->val_string;
+    const Param *parent_id_field = param_parent_id_field;
+    const Param *id_field = param_id_field;
     GSequence *sequence = param_sequence->val_custom;
 
     GHashTable *parent_children = g_hash_table_new(g_str_hash, g_str_equal);
     GHashTable *item_order = g_hash_table_new(g_str_hash, g_str_equal);
+    GSequence *root_items = g_sequence_new(free_param);
+    GSequence *non_root_items = g_sequence_new(NULL);
+    Forest *result = NULL;
 
     // ---------------------------------
     // Iterate over all items and add them to an item hash, a children hash, and an order hash
@@ -169,6 +211,8 @@ static void EC_forest(gpointer gp_entry) {
         if (!param) continue;
 
         gchar *item_id = get_id(id_field, param);
+        if (!item_id) goto done;
+
         g_hash_table_insert(parent_children, (gpointer) item_id, g_sequence_new(free_param));
         g_hash_table_insert(item_order, (gpointer) item_id, (gpointer) position);
     }
@@ -176,14 +220,13 @@ static void EC_forest(gpointer gp_entry) {
     // ---------------------------------
     // Split the items into those whose parents are in the table and whose parents aren't
     // ---------------------------------
-    GSequence *root_items = g_sequence_new(free_param);
-    GSequence *non_root_items = g_sequence_new(NULL);
-
     FOREACH_SEQ(iter, sequence) {
         Param *item = g_sequence_get(iter);
         if (!item) continue;
 
         gchar *item_parent_id = get_id(parent_id_field, item);
+        if (!item_parent_id) goto done;
+
         if (g_hash_table_contains(parent_children, (gpointer) item_parent_id)) {
             g_sequence_append(non_root_items, item);
         }
@@ -210,26 +253,38 @@ static void EC_forest(gpointer gp_entry) {
         COPY_PARAM(param_new, item);
 
         gchar *item_parent_id = get_id(parent_id_field, param_new);
+        if (!item_parent_id) {
+            free_param(param_new);
+            goto done;
+        }
+
         GSequence *children = g_hash_table_lookup(parent_children, (gpointer) item_parent_id);
         g_sequence_insert_sorted(children, param_new, compare_item_order, &order_info);
         g_free(item_parent_id);
     }
 
     // Push result
-    Forest *result = g_new(Forest, 1);
+    result = g_new(Forest, 1);
     result->children = parent_children;
     result->root_items = root_items; 
-    g_strlcpy(result->id_field, id_field, MAX_FIELD_LEN);
-    g_strlcpy(result->parent_id_field, parent_id_field, MAX_FIELD_LEN);
-    push_param(new_custom_param(result, "Forest", free_forest, copy_forest_gp));
+    // The forest takes ownership of the ID field params
+    result->id_field = param_id_field;
+    result->parent_id_field = param_parent_id_field;
+    push_param(new_custom_param(result, &_forest_type));
 
+done:
     // Clean up
+    if (!result) {
+        g_hash_table_foreach(parent_children, free_forest_entry, NULL);
+        g_hash_table_destroy(parent_children);
+        g_sequence_free(root_items);
+        free_param(param_id_field);
+        free_param(param_parent_id_field);
+    }
     g_sequence_free(non_root_items);
     g_hash_table_destroy(item_order);
 
     free_param(param_sequence);
-    free_param(param_id_field);
-    free_param(param_parent_id_field);
 }
 
 
@@ -253,6 +308,8 @@ static void print_hierarchy(FILE *file, Param *item, Forest *forest, gint level,
     print_param(file, item);
 
     gchar *item_id = get_id(forest->id_field, item);
+    if (!item_id) return;
+
     GSequence *children = g_hash_table_lookup(forest->children, (gpointer) item_id);
     g_free(item_id);
 
@@ -283,5 +340,5 @@ static void print_forest(FILE *file, Param *param) {
 
 void EC_add_trees_lexicon(gpointer gp_entry) {
     add_entry("forest")->routine = EC_forest;
-    add_print_function("Forest", print_forest);
+    add_custom_type(&_forest_type);
 }
@@ -2,8 +2,8 @@
 
 \brief All global objects are here.
 
-This defines the main components of the Forth interpreter: _dictionary,
-_stack, and _return_stack.
+The state of an interpreter (its dictionary, stacks, and so on) is in a KitVM
+(see vm.c). Each thread runs at most one interpreter at a time: _vm.
 
 */
 
@@ -11,22 +11,7 @@ _stack, and _return_stack.
 // Globals
 // =============================================================================
 
-GList *_dictionary = NULL;      /**< \brief Global Forth dictionary */
-GQueue *_stack = NULL;          /**< \brief Global Param stack */
-GQueue *_return_stack = NULL;   /**< \brief Global return stack */
-jmp_buf _error_jmp_buf;         /**< \brief Global jump buffer for error handling */
-
-
-/** Global interpreter mode. The legal values are:
-
-    - E: Execution mode (normal)
-    - C: Compilation mode (during word definition)
-*/
-gchar _mode = 'E';              /**< \brief 'E'xecuting or 'C'ompiling */
-
-GSequenceIter *_ip = NULL;      /**< \brief Next instruction (Param) to execute in a definition */
-
-gboolean _quit = 0;             /**< \brief To quit program cleanly, set _quit=1 */
+__thread KitVM *_vm = NULL;         /**< \brief Interpreter running on this thread (see use_vm) */
 
 
 
@@ -41,6 +26,7 @@ static gchar unknown_token_type[] = "Unknown token type";
 static gchar stack_underflow[] = "Stack underflow";
 static gchar invalid_param[] = "Invalid parameter";
 static gchar generic_error[] = "Generic error";
+static gchar return_stack_overflow[] = "Return stack overflow";
 
 
 // -----------------------------------------------------------------------------
@@ -74,6 +60,10 @@ const gchar *error_type_to_string(gint error_type) {
             result = generic_error;
             break;
 
+        case ERR_RETURN_STACK_OVERFLOW:
+            result = return_stack_overflow;
+            break;
+
         default:
             result = unknown_error;
             break;
@@ -92,19 +82,20 @@ token with type equal to EOF.
 // -----------------------------------------------------------------------------
 Token get_token() {
     Token result;
-    result.type = yylex();
+    result.type = next_token(&result);
 
     switch(result.type) {
         case 'S': case 'I': case 'D': case 'W':
-            g_strlcpy(result.word, yytext, MAX_WORD_LEN);
             break;
 
         case EOF:
-            g_strlcpy(result.word, "EOF", MAX_WORD_LEN);
+            result.word = "EOF";
+            result.len = 3;
             break;
 
         default:
-            g_strlcpy(result.word, "?", MAX_WORD_LEN);
+            result.word = "?";
+            result.len = 1;
             break;
     }
 
@@ -116,15 +107,51 @@ Token get_token() {
 // -----------------------------------------------------------------------------
 /** Prints out the error type and resets the state of the interpreter.
 
+The interpreter's error flag is set and stays set.
 */
 // -----------------------------------------------------------------------------
 void handle_error(gint error_type) {
-    fprintf(stderr, "%s\n", error_type_to_string(error_type));
+    fprintf(_vm->err, "%s\n", error_type_to_string(error_type));
+    _vm->error = TRUE;
 
-    // Reset stacks, _ip, and _mode
-    _ip = NULL;
+    // Reset stacks, ip, and mode
+    _vm->ip = NULL;
     clear_stack();
     clear_stack_r();
+    clear_quotations();
+    clear_control_frames();
+
+    _vm->mode = 'E';
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Clears the error flag so a word can tell if the blocks it runs have an error.
 
-    _mode = 'E';
+Since the flag stays set, words like filter use this to see only their own
+errors, and then put the flag back with restore_error_flag.
+
+\returns The flag's previous value
+*/
+// -----------------------------------------------------------------------------
+gboolean save_error_flag() {
+    gboolean result = _vm->error;
+    _vm->error = FALSE;
+    return result;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Sets the error flag again after save_error_flag.
+
+\param error_prev: Value returned by save_error_flag
+\returns TRUE if there was an error since save_error_flag
+*/
+// -----------------------------------------------------------------------------
+gboolean restore_error_flag(gboolean error_prev) {
+    gboolean result = _vm->error;
+    _vm->error = error_prev || result;
+    return result;
 }
@@ -15,17 +15,12 @@
 #define ERR_STACK_UNDERFLOW  3
 #define ERR_INVALID_PARAM  4
 #define ERR_GENERIC_ERROR  5
+#define ERR_RETURN_STACK_OVERFLOW  6
 
 
 // =============================================================================
 // External functions
 // =============================================================================
-extern int yyleng;
-extern int yylex();          /**< \brief Gets next token from the input stream */
-extern void yyrestart(FILE *file);
-extern int yylex_destroy();  /**< \brief Gets next token from the input stream */
-extern FILE* yyin;           /**< \brief Points to the input stream */
-extern char *yytext;         /**< \brief Current token */
 extern void scan_string(const char* str);
 extern void scan_file(FILE* file);
 extern void destroy_input_stack();
@@ -52,20 +47,31 @@ typedef struct {
     gchar type;
 
     /** Characters parsed from the input stream.
+
+        This points into the input source's buffer rather than being copied,
+        so it is only valid until the next token is read from that source.
+    */
+    const gchar *word;
+
+    /** Number of characters in word
+    */
+    gint len;
+
+    /** Value of a number, converted by the lexer
     */
-    gchar word[MAX_WORD_LEN];
+    union {
+        gint64 val_int;         /**< \brief Value of an 'I' token */
+        gdouble val_double;     /**< \brief Value of a 'D' token */
+    };
 } Token;
 
 
-extern GList *_dictionary;
-extern GQueue *_stack;
-extern GQueue *_return_stack;
-extern gchar _mode;
-extern jmp_buf _error_jmp_buf;
-extern GSequenceIter *_ip;
-extern gboolean _quit;
+extern __thread KitVM *_vm;
 
 const gchar *error_type_to_string(gint error_type);
+extern int next_token(Token *token);   /**< \brief Gets next token from the current input source */
 Token get_token();
 void handle_error(gint error_type);
+gboolean save_error_flag();
+gboolean restore_error_flag(gboolean error_prev);
 void push_token(Token token);
@@ -14,55 +14,137 @@ Problem-oriented-language" by Chuck Moore in 1970.
 The main function sets up the initial dictionary and the main control loop that
 basically gets a token from the input stream and executes it.
 
+Usage:
+
+- kit [file]: Runs the file (or stdin)
+- kit --serve socket-path [file]: Runs the file and then serves commands sent
+  to the socket with the words it defined (see server.c). If the file reads
+  from stdin (e.g., with ".i"), serving starts once stdin is done.
+- kit --client socket-path [command...]: Sends a command (or stdin) to a server
+  and prints its output
+- kit --batch [-j N] script...: Runs the scripts on N threads (default: one per
+  processor) and prints their output in order (see batch.c)
+
 */
 // =============================================================================
 
 
 
+// -----------------------------------------------------------------------------
+/** Reads all of a file into a new string (free with g_free)
+*/
+// -----------------------------------------------------------------------------
+static gchar *read_file(FILE *file) {
+    GString *result = g_string_new(NULL);
+    gchar buf[4096];
+    gsize num_read;
+    while ((num_read = fread(buf, 1, sizeof(buf), file)) > 0) {
+        g_string_append_len(result, buf, num_read);
+    }
+    return g_string_free(result, FALSE);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Prints how kit is run (see the usage above)
+*/
+// -----------------------------------------------------------------------------
+static void print_usage() {
+    fprintf(stderr, "Usage: kit [file]\n");
+    fprintf(stderr, "       kit --serve socket-path [file]\n");
+    fprintf(stderr, "       kit --client socket-path [command...]\n");
+    fprintf(stderr, "       kit --batch [-j N] script...\n");
+}
+
+
+
 // -----------------------------------------------------------------------------
 /** Sets up the interpreter and then runs the main control loop.
 */
 // -----------------------------------------------------------------------------
 int main(int argc, char *argv[]) {
     FILE *input_file = NULL;
+    const gchar *serve_path = NULL;
+    gint file_arg = 1;
+    gint result = 0;
+
+    // The client only forwards its command, so it doesn't need a dictionary
+    if (argc > 2 && STR_EQ(argv[1], "--client")) {
+        gchar *command = argc > 3 ? g_strjoinv(" ", argv + 3) : read_file(stdin);
+        result = run_client(argv[2], command);
+        g_free(command);
+        return result;
+    }
 
+    if (argc > 2 && STR_EQ(argv[1], "--serve")) {
+        serve_path = argv[2];
+        file_arg = 3;
+    }
+
+    create_allocator();
+    create_custom_types();
     build_dictionary();
-    create_print_functions();
-    create_stack();
-    create_stack_r();
 
-    // Open input file if specified; otherwise stdin
-    if (argc > 1) {
-        input_file = fopen(argv[1], "r");
+    // Each script in a batch gets its own interpreter
+    if (argc > 1 && STR_EQ(argv[1], "--batch")) {
+        gint num_threads = g_get_num_processors();
+        gint path_arg = 2;
+        if (argc > 2 && STR_EQ(argv[2], "-j")) {
+            if (argc < 4) {
+                print_usage();
+                exit(1);
+            }
+
+            gchar *end = NULL;
+            gint64 count = g_ascii_strtoll(argv[3], &end, 10);
+            if (end == argv[3] || *end != '\0' || count < 1 || count > G_MAXINT) {
+                fprintf(stderr, "Expected a positive number of threads: %s\n", argv[3]);
+                exit(1);
+            }
+            num_threads = count;
+            path_arg = 4;
+        }
+
+        result = run_batch(num_threads, argv + path_arg, argc - path_arg);
+        destroy_worker_pool();
+        destroy_pair_profile();
+        destroy_custom_types();
+        destroy_dictionary();
+        destroy_allocator();
+        return result;
+    }
+
+    KitVM *vm = create_vm();
+    use_vm(vm);
+
+    // Open input file if specified; otherwise stdin (unless serving)
+    if (argc > file_arg) {
+        input_file = fopen(argv[file_arg], "r");
         if (!input_file) {
-            fprintf(stderr, "Unable to open file: %s\n", argv[1]);
+            fprintf(stderr, "Unable to open file: %s\n", argv[file_arg]);
             exit(1);
         }
         scan_file(input_file);
     }
-    else {
+    else if (!serve_path) {
         scan_file(stdin);
     }
 
+    run_vm();
 
-    // Control loop
-    while(!_quit) {
-        Token token = get_token();
-
-        if (token.type == EOF) break;
-        if (token.type == '^') continue;   // If EOS, keep going
-
-        process_token(token);
+    if (serve_path) {
+        result = serve(serve_path);
     }
 
     // Clean up
-    destroy_stack_r();
-    destroy_stack();
-    destroy_print_functions();
+    destroy_vm(vm);
+    destroy_worker_pool();
+    destroy_pair_profile();
+    destroy_custom_types();
     destroy_dictionary();
-
-    destroy_input_stack();
-    yylex_destroy();
+    destroy_allocator();
 
     if (input_file) fclose(input_file);
+    return result;
 }
@@ -0,0 +1,757 @@
+/** \file optimize.c
+
+\brief Optimizer for compiled definitions.
+
+When a definition (or a quotation or a cached string) is complete, its cells
+go through these passes:
+
+1. Inlining: calls to short definitions (at most MAX_INLINE_CELLS cells, not
+   counting the return) are replaced by copies of their cells. This saves the
+   return stack push, the jump, and the OP_RETURN of each call. A definition
+   that calls itself is never inlined.
+
+2. Constant folding: calls to constants become literals, and calls to pure
+   words (see Entry::pure) whose inputs are all numeric literals are run at
+   compile time and replaced by a literal with the result.
+
+3. Tail calls: a call to a definition that is followed by a return (directly
+   or through jumps) becomes OP_TAIL_CALL, which doesn't push a return stack
+   frame. This lets recursive words (see "recurse") run in constant return
+   stack space.
+
+4. Superinstructions: common pairs of cells are replaced by single cells (see
+   \ref cell_ops "Cell ops"):
+
+   - literal word         ->  OP_LITERAL_CALL
+   - variable @           ->  OP_FETCH_VARIABLE
+   - "name" @field        ->  OP_GET_FIELD
+   - swap swap, dup pop,
+     dup drop             ->  (removed)
+
+Cells that are jumped to are never folded or fused into the cells before them.
+Jump offsets are recomputed after each pass that moves cells around.
+
+After these passes, the stack effect of the optimized code is inferred (see
+stack_effect.c), which may replace some calls with unchecked stack ops.
+
+Since definitions are optimized when they're complete, ".d" shows the optimized
+code. Redefining a word doesn't change definitions that were compiled with the
+old one, so inlining it doesn't either.
+
+When built with KIT_PAIR_PROFILE (configure with --enable-pair-profile), the
+inner interpreter counts how often each cell is executed along with the cell
+that follows it. The ".pairs" word prints the most frequent pairs, which are
+the candidates for new superinstructions. Each interpreter counts its own
+pairs, and its counts are added to the process-wide totals when it's destroyed
+(e.g., when a pmap chunk is done). ".pairs" prints the totals along with the
+counts of the interpreter that runs it.
+*/
+
+#define MAX_INLINE_CELLS 8          /**< \brief Longest definition (in cells) that is inlined */
+#define MAX_CELL_NAME_LEN 48        /**< \brief Longest cell description in the pair profile */
+#define NUM_PAIRS_TO_PRINT 20       /**< \brief Number of pairs printed by print_pair_profile */
+
+#define INLINED_CELL G_MAXUINT      /**< \brief Old index of cells copied from an inlined definition */
+
+
+/** \brief State of a pass that rewrites an entry's code into a new array
+
+Each pass records where every old cell ended up (new_index) and where every new
+cell came from (old_index) so the jumps can be pointed at the new locations of
+their targets when the pass is done.
+*/
+typedef struct {
+    GArray *code;               /**< \brief Cells being rewritten */
+    GArray *result;             /**< \brief Rewritten cells */
+    gboolean *is_target;        /**< \brief TRUE for each old cell that is the target of a jump */
+    guint *new_index;           /**< \brief Maps old cell indexes to new ones */
+    GArray *old_index;          /**< \brief Maps new cell indexes to old ones (or INLINED_CELL) */
+} Rewrite;
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if a cell may jump (by its jmp_offset)
+*/
+// -----------------------------------------------------------------------------
+static gboolean is_jmp(const Cell *cell) {
+    switch(cell->op) {
+        case OP_JMP:
+        case OP_JMP_IF_FALSE:
+        case OP_DO:
+        case OP_LOOP:
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if a cell calls an entry with the specified routine
+*/
+// -----------------------------------------------------------------------------
+static gboolean calls_routine(const Cell *cell, routine_ptr routine) {
+    return cell->op == OP_CALL && cell->entry->routine == routine;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Starts rewriting an entry's code
+*/
+// -----------------------------------------------------------------------------
+static void begin_rewrite(Rewrite *rewrite, Entry *entry) {
+    GArray *code = entry->code;
+    guint len = code->len;
+
+    rewrite->code = code;
+    rewrite->result = g_array_sized_new(FALSE, TRUE, sizeof(Cell), len);
+    rewrite->new_index = g_new(guint, len + 1);
+    rewrite->old_index = g_array_sized_new(FALSE, FALSE, sizeof(guint), len);
+
+    rewrite->is_target = g_new0(gboolean, len + 1);
+    for (guint i=0; i < len; i++) {
+        Cell *cell = &g_array_index(code, Cell, i);
+        if (is_jmp(cell)) {
+            rewrite->is_target[i + cell->jmp_offset] = TRUE;
+        }
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Appends a cell to the rewritten code.
+
+\param old_index: Index of the old cell it came from (or INLINED_CELL)
+*/
+// -----------------------------------------------------------------------------
+static void emit_cell(Rewrite *rewrite, const Cell *cell, guint old_index) {
+    g_array_append_val(rewrite->result, *cell);
+    g_array_append_val(rewrite->old_index, old_index);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Points the jumps at the new locations of their targets and replaces the
+    entry's code with the rewritten code.
+
+Cells copied from an inlined definition keep their offsets, since the cells
+they jump over were copied along with them.
+
+\note Literals belong to the cells that were emitted, so the old array is freed
+      without freeing them.
+*/
+// -----------------------------------------------------------------------------
+static void end_rewrite(Rewrite *rewrite, Entry *entry) {
+    GArray *result = rewrite->result;
+    rewrite->new_index[rewrite->code->len] = result->len;
+
+    for (guint j=0; j < result->len; j++) {
+        Cell *cell = &g_array_index(result, Cell, j);
+        guint old_index = g_array_index(rewrite->old_index, guint, j);
+        if (is_jmp(cell) && old_index != INLINED_CELL) {
+            guint target = old_index + cell->jmp_offset;
+            cell->jmp_offset = (gint64) rewrite->new_index[target] - (gint64) j;
+        }
+    }
+
+    g_array_free(rewrite->code, TRUE);
+    entry->code = result;
+
+    g_array_free(rewrite->old_index, TRUE);
+    g_free(rewrite->new_index);
+    g_free(rewrite->is_target);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if an op replaces a call in a verified definition (see
+    stack_effect.c). These cells still point to the entry they call.
+*/
+// -----------------------------------------------------------------------------
+static gboolean is_unchecked_op(CellOp op) {
+    return op == OP_DUP || op == OP_SWAP || op == OP_DROP;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if calls to callee can be replaced by copies of its cells.
+*/
+// -----------------------------------------------------------------------------
+static gboolean is_inlinable(const Entry *callee, const Entry *caller) {
+    if (callee == caller || callee->routine != EC_execute || !callee->code) return FALSE;
+    if (!callee->complete || callee->code->len > MAX_INLINE_CELLS + 1) return FALSE;
+
+    // The only return must be the last cell, and the callee must not call itself
+    for (guint i=0; i < callee->code->len - 1; i++) {
+        Cell *cell = &g_array_index(callee->code, Cell, i);
+        if (cell->op == OP_RETURN) return FALSE;
+        if ((cell->op == OP_CALL || cell->op == OP_TAIL_CALL || cell->op == OP_LITERAL_CALL) &&
+            cell->entry == callee) return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Replaces calls to short definitions with copies of their cells.
+
+The callee's final OP_RETURN isn't copied, so jumps to it land on the cell
+after the inlined code. Tail calls in the callee aren't in tail position once
+they're inlined, and the caller may not have been verified, so tail calls and
+unchecked stack ops are copied as regular calls.
+*/
+// -----------------------------------------------------------------------------
+static void inline_calls(Entry *entry) {
+    Rewrite rewrite;
+    begin_rewrite(&rewrite, entry);
+
+    for (guint i=0; i < rewrite.code->len; i++) {
+        Cell *cell = &g_array_index(rewrite.code, Cell, i);
+        rewrite.new_index[i] = rewrite.result->len;
+
+        if (cell->op != OP_CALL || !is_inlinable(cell->entry, entry)) {
+            emit_cell(&rewrite, cell, i);
+            continue;
+        }
+
+        GArray *callee_code = cell->entry->code;
+        for (guint k=0; k < callee_code->len - 1; k++) {
+            Cell copy = g_array_index(callee_code, Cell, k);
+            if (copy.op == OP_TAIL_CALL || is_unchecked_op(copy.op)) {
+                copy.op = OP_CALL;
+            }
+            if (copy.literal) {
+                COPY_PARAM(literal, copy.literal);
+                copy.literal = literal;
+            }
+            emit_cell(&rewrite, &copy, INLINED_CELL);
+        }
+    }
+
+    end_rewrite(&rewrite, entry);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if a cell pushes a numeric literal
+*/
+// -----------------------------------------------------------------------------
+static gboolean is_number_literal(const Cell *cell) {
+    return cell->op == OP_PUSH_LITERAL && (cell->literal->type == 'I' || cell->literal->type == 'D');
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Runs a pure word on the literals at the end of the rewritten code, replacing
+    the literals and the call (the last cell) with the result.
+
+Nothing is folded if the inputs aren't all numeric literals or if any cell after
+the first input is the target of a jump.
+*/
+// -----------------------------------------------------------------------------
+static void fold_pure_call(Rewrite *rewrite) {
+    GArray *result = rewrite->result;
+    guint call_index = result->len - 1;
+    Entry *callee = g_array_index(result, Cell, call_index).entry;
+    guint num_inputs = callee->effect.num_in;
+
+    if (result->len < num_inputs + 1) return;
+    guint first_index = call_index - num_inputs;
+
+    for (guint j=first_index; j <= call_index; j++) {
+        Cell *cell = &g_array_index(result, Cell, j);
+        if (j < call_index && !is_number_literal(cell)) return;
+
+        guint old_index = g_array_index(rewrite->old_index, guint, j);
+        if (j > first_index && rewrite->is_target[old_index]) return;
+    }
+
+    // Run the word on the real stack, above whatever is there now
+    guint depth = get_stack_depth();
+    for (guint j=first_index; j < call_index; j++) {
+        push_param_copy(g_array_index(result, Cell, j).literal);
+    }
+    callee->routine(callee);
+    if (get_stack_depth() != depth + 1) {
+        drop_cells(get_stack_depth() - depth);
+        return;
+    }
+    Param *param_result = pop_param();
+
+    for (guint j=first_index; j < call_index; j++) {
+        free_param(g_array_index(result, Cell, j).literal);
+    }
+
+    Cell *cell_first = &g_array_index(result, Cell, first_index);
+    cell_first->op = OP_PUSH_LITERAL;
+    cell_first->literal = param_result;
+    g_array_set_size(result, first_index + 1);
+    g_array_set_size(rewrite->old_index, first_index + 1);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Replaces constants with literals and folds pure words applied to literals.
+
+Since folding looks back at the cells that were already rewritten, chains like
+"3 negate negate" fold completely.
+*/
+// -----------------------------------------------------------------------------
+static void fold_constants(Entry *entry) {
+    Rewrite rewrite;
+    begin_rewrite(&rewrite, entry);
+
+    for (guint i=0; i < rewrite.code->len; i++) {
+        Cell cell = g_array_index(rewrite.code, Cell, i);
+        rewrite.new_index[i] = rewrite.result->len;
+
+        if (calls_routine(&cell, EC_push_param0)) {
+            const Param *value = g_sequence_get(g_sequence_get_begin_iter(cell.entry->params));
+            if (value->type == 'I' || value->type == 'D' || value->type == 'S') {
+                COPY_PARAM(literal, value);
+                cell.op = OP_PUSH_LITERAL;
+                cell.literal = literal;
+            }
+        }
+
+        emit_cell(&rewrite, &cell, i);
+
+        if (cell.op == OP_CALL && cell.entry->pure) {
+            fold_pure_call(&rewrite);
+        }
+    }
+
+    end_rewrite(&rewrite, entry);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if executing the code from a cell returns right away (the cell
+    is an OP_RETURN, or jumps lead to one)
+*/
+// -----------------------------------------------------------------------------
+static gboolean returns_from(GArray *code, guint index) {
+    // Bounded in case of a jump cycle
+    for (guint num_jumps=0; num_jumps <= code->len; num_jumps++) {
+        Cell *cell = &g_array_index(code, Cell, index);
+        if (cell->op == OP_RETURN) return TRUE;
+        if (cell->op != OP_JMP) return FALSE;
+        index += cell->jmp_offset;
+    }
+    return FALSE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Turns calls to definitions that are followed by a return into tail calls.
+
+A tail call reuses the caller's return stack frame, so recursion in tail
+position doesn't grow the return stack.
+*/
+// -----------------------------------------------------------------------------
+static void mark_tail_calls(Entry *entry) {
+    GArray *code = entry->code;
+    for (guint i=0; i + 1 < code->len; i++) {
+        Cell *cell = &g_array_index(code, Cell, i);
+        if (cell->op == OP_CALL && cell->entry->routine == EC_execute && returns_from(code, i + 1)) {
+            cell->op = OP_TAIL_CALL;
+        }
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Tries to replace a pair of cells with a superinstruction.
+
+\param first: First cell of the pair
+\param second: Cell following first
+\param fused: Filled out with the superinstruction
+\returns 1 if the pair was fused into one cell, 0 if the pair can be dropped
+         entirely, and -1 if the pair can't be optimized
+\note Ownership of any literal moves from first to fused.
+*/
+// -----------------------------------------------------------------------------
+static gint fuse_cells(const Cell *first, const Cell *second, Cell *fused) {
+    memset(fused, 0, sizeof(Cell));
+
+    // (a b -- b a) twice is a no-op; so is copying a value and dropping the copy
+    if (calls_routine(first, EC_swap) && calls_routine(second, EC_swap)) {
+        return 0;
+    }
+    if (calls_routine(first, EC_dup) &&
+        (calls_routine(second, EC_pop) || calls_routine(second, EC_drop))) {
+        return 0;
+    }
+
+    if (calls_routine(first, EC_push_entry_address) && calls_routine(second, EC_fetch_variable_value)) {
+        fused->op = OP_FETCH_VARIABLE;
+        fused->entry = first->entry;
+        return 1;
+    }
+
+    if (first->op == OP_PUSH_LITERAL && second->op == OP_CALL) {
+        if (first->literal->type == 'S' && second->entry->routine == EC_get_field) {
+            fused->op = OP_GET_FIELD;
+        }
+        else {
+            fused->op = OP_LITERAL_CALL;
+        }
+        fused->entry = second->entry;
+        fused->literal = first->literal;
+        return 1;
+    }
+
+    return -1;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Replaces common pairs of cells with superinstructions
+*/
+// -----------------------------------------------------------------------------
+static void fuse_pairs(Entry *entry) {
+    Rewrite rewrite;
+    begin_rewrite(&rewrite, entry);
+
+    guint len = rewrite.code->len;
+    for (guint i=0; i < len; i++) {
+        Cell *cell = &g_array_index(rewrite.code, Cell, i);
+        rewrite.new_index[i] = rewrite.result->len;
+
+        if (i + 1 < len && !rewrite.is_target[i + 1]) {
+            Cell fused;
+            gint num_fused = fuse_cells(cell, cell + 1, &fused);
+            if (num_fused >= 0) {
+                rewrite.new_index[i + 1] = rewrite.result->len;
+                if (num_fused == 1) {
+                    emit_cell(&rewrite, &fused, i);
+                }
+                i++;
+                continue;
+            }
+        }
+
+        emit_cell(&rewrite, cell, i);
+    }
+
+    end_rewrite(&rewrite, entry);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Optimizes an entry's compiled code.
+
+\param entry: A complete entry (its code ends with OP_RETURN)
+*/
+// -----------------------------------------------------------------------------
+void optimize_entry(Entry *entry) {
+    if (!entry->code) return;
+
+    inline_calls(entry);
+    fold_constants(entry);
+    mark_tail_calls(entry);
+    fuse_pairs(entry);
+}
+
+
+
+#ifdef KIT_PAIR_PROFILE
+
+/** \brief Number of times a cell was executed before the cell after it
+*/
+typedef struct {
+    guint64 count;
+    gchar name[2 * MAX_CELL_NAME_LEN];   /**< \brief Descriptions of both cells */
+} PairCount;
+
+
+static GHashTable *_pair_totals = NULL;    /**< \brief Maps pair names to PairCount objects (guarded by the pair_totals lock) */
+G_LOCK_DEFINE_STATIC(pair_totals);
+
+
+
+// -----------------------------------------------------------------------------
+/** Writes a short description of a cell for the pair profile
+*/
+// -----------------------------------------------------------------------------
+static void describe_cell(const Cell *cell, gchar *dst, gsize len) {
+    switch(cell->op) {
+        case OP_CALL:
+            g_strlcpy(dst, cell->entry->word, len);
+            break;
+
+        case OP_PUSH_LITERAL:
+            switch(cell->literal->type) {
+                case 'I':
+                    snprintf(dst, len, "%ld", cell->literal->val_int);
+                    break;
+
+                case 'S':
+                    snprintf(dst, len, "\"%s\"", cell->literal->val_string);
+                    break;
+
+                default:
+                    snprintf(dst, len, "literal-%c", cell->literal->type);
+                    break;
+            }
+            break;
+
+        case OP_JMP:
+            g_strlcpy(dst, "jmp", len);
+            break;
+
+        case OP_JMP_IF_FALSE:
+            g_strlcpy(dst, "jmp-if-false", len);
+            break;
+
+        case OP_RETURN:
+            g_strlcpy(dst, ";", len);
+            break;
+
+        case OP_TAIL_CALL:
+            snprintf(dst, len, "tail:%s", cell->entry->word);
+            break;
+
+        case OP_DO:
+            g_strlcpy(dst, "do", len);
+            break;
+
+        case OP_LOOP:
+            g_strlcpy(dst, "loop", len);
+            break;
+
+        case OP_LOOP_INDEX:
+            g_strlcpy(dst, cell->loop_level == 0 ? "i" : "j", len);
+            break;
+
+        case OP_DUP:
+        case OP_SWAP:
+        case OP_DROP:
+            snprintf(dst, len, "%s!", cell->entry->word);
+            break;
+
+        case OP_INT_LITERAL:
+            snprintf(dst, len, "int:%ld", cell->val_int);
+            break;
+
+        case OP_INT_JMP_IF_FALSE:
+            g_strlcpy(dst, "int:jmp-if-false", len);
+            break;
+
+        case OP_INT_CALL:
+        case OP_INT_ADD:
+        case OP_INT_SUBTRACT:
+        case OP_INT_MULTIPLY:
+        case OP_INT_EQUAL:
+        case OP_INT_NOT_EQUAL:
+        case OP_INT_LESS:
+        case OP_INT_GREATER:
+        case OP_INT_LESS_EQUAL:
+        case OP_INT_GREATER_EQUAL:
+            snprintf(dst, len, "int:%s", cell->entry->word);
+            break;
+
+        case OP_LITERAL_CALL:
+            snprintf(dst, len, "literal+%s", cell->entry->word);
+            break;
+
+        case OP_FETCH_VARIABLE:
+            snprintf(dst, len, "%s@", cell->entry->word);
+            break;
+
+        case OP_GET_FIELD:
+            snprintf(dst, len, "\"%s\"@field", cell->literal->val_string);
+            break;
+
+        default:
+            g_strlcpy(dst, "?", len);
+            break;
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Counts an execution of a cell followed by the next cell of its definition.
+
+This is called by the inner interpreter for every cell it executes. The counts
+are kept in the thread's interpreter, so this doesn't take any locks.
+*/
+// -----------------------------------------------------------------------------
+void record_cell_pair(const Cell *cell) {
+    if (cell->op == OP_RETURN) return;
+
+    GHashTable *pair_counts = _vm->pair_counts;
+    if (!pair_counts) {
+        pair_counts = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+        _vm->pair_counts = pair_counts;
+    }
+
+    PairCount *pair_count = g_hash_table_lookup(pair_counts, cell);
+    if (!pair_count) {
+        gchar first[MAX_CELL_NAME_LEN];
+        gchar second[MAX_CELL_NAME_LEN];
+        describe_cell(cell, first, MAX_CELL_NAME_LEN);
+        describe_cell(cell + 1, second, MAX_CELL_NAME_LEN);
+
+        pair_count = g_new0(PairCount, 1);
+        snprintf(pair_count->name, sizeof(pair_count->name), "%s %s", first, second);
+        g_hash_table_insert(pair_counts, (gpointer) cell, pair_count);
+    }
+    pair_count->count++;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Adds a count to the total for its pair of names
+*/
+// -----------------------------------------------------------------------------
+static void add_to_pair_totals(gpointer gp_unused, gpointer gp_pair_count, gpointer gp_totals) {
+    PairCount *pair_count = gp_pair_count;
+    GHashTable *totals = gp_totals;
+
+    PairCount *total = g_hash_table_lookup(totals, pair_count->name);
+    if (!total) {
+        total = g_new0(PairCount, 1);
+        g_strlcpy(total->name, pair_count->name, sizeof(total->name));
+        g_hash_table_insert(totals, total->name, total);
+    }
+    total->count += pair_count->count;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns an empty table of PairCount objects keyed by their names
+*/
+// -----------------------------------------------------------------------------
+static GHashTable *new_pair_totals() {
+    return g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Adds the thread's interpreter's counts to the totals and clears them.
+
+This is called when an interpreter is destroyed.
+*/
+// -----------------------------------------------------------------------------
+void merge_pair_profile() {
+    if (!_vm->pair_counts) return;
+
+    G_LOCK(pair_totals);
+    if (!_pair_totals) {
+        _pair_totals = new_pair_totals();
+    }
+    g_hash_table_foreach(_vm->pair_counts, add_to_pair_totals, _pair_totals);
+    G_UNLOCK(pair_totals);
+
+    g_hash_table_destroy(_vm->pair_counts);
+    _vm->pair_counts = NULL;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Orders PairCount objects by decreasing count
+*/
+// -----------------------------------------------------------------------------
+static gint cmp_pair_counts(gconstpointer l, gconstpointer r) {
+    const PairCount *pair_l = *(PairCount * const *) l;
+    const PairCount *pair_r = *(PairCount * const *) r;
+
+    if (pair_l->count == pair_r->count) return 0;
+    return pair_l->count > pair_r->count ? -1 : 1;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Prints the most frequently executed pairs of cells.
+
+This includes the counts of interpreters that have been destroyed and of the
+thread's interpreter, but not of other interpreters that are still running.
+*/
+// -----------------------------------------------------------------------------
+void print_pair_profile(FILE *file) {
+    // Cells with the same descriptions (e.g., in different definitions) count as one pair
+    GHashTable *totals = new_pair_totals();
+    G_LOCK(pair_totals);
+    if (_pair_totals) {
+        g_hash_table_foreach(_pair_totals, add_to_pair_totals, totals);
+    }
+    G_UNLOCK(pair_totals);
+    if (_vm->pair_counts) {
+        g_hash_table_foreach(_vm->pair_counts, add_to_pair_totals, totals);
+    }
+
+    if (g_hash_table_size(totals) == 0) {
+        fprintf(file, "No pairs recorded\n");
+        g_hash_table_destroy(totals);
+        return;
+    }
+
+    GPtrArray *sorted = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, totals);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_ptr_array_add(sorted, value);
+    }
+    g_ptr_array_sort(sorted, cmp_pair_counts);
+
+    fprintf(file, "%12s  %s\n", "count", "pair");
+    for (guint i=0; i < sorted->len && i < NUM_PAIRS_TO_PRINT; i++) {
+        PairCount *total = g_ptr_array_index(sorted, i);
+        fprintf(file, "%12ld  %s\n", total->count, total->name);
+    }
+
+    g_ptr_array_free(sorted, TRUE);
+    g_hash_table_destroy(totals);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Frees the pair profile totals
+*/
+// -----------------------------------------------------------------------------
+void destroy_pair_profile() {
+    if (_pair_totals) {
+        g_hash_table_destroy(_pair_totals);
+        _pair_totals = NULL;
+    }
+}
+
+#else
+
+void merge_pair_profile() {
+}
+
+void print_pair_profile(FILE *file) {
+    fprintf(file, "Pair profiling is off (configure with --enable-pair-profile)\n");
+}
+
+void destroy_pair_profile() {
+}
+
+#endif
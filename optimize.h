@@ -0,0 +1,17 @@
+/** \file optimize.h
+*/
+
+#pragma once
+
+void optimize_entry(Entry *entry);
+
+#ifdef KIT_PAIR_PROFILE
+void record_cell_pair(const Cell *cell);
+#define PROFILE_CELL_PAIR(_cell_) record_cell_pair(_cell_)
+#else
+#define PROFILE_CELL_PAIR(_cell_)
+#endif
+
+void merge_pair_profile();
+void print_pair_profile(FILE *file);
+void destroy_pair_profile();
@@ -0,0 +1,293 @@
+/** \file parallel.c
+
+\brief Runs work on a pool of worker threads.
+
+Parallel sequence words (e.g., pmap) split a sequence into chunks and hand each
+chunk to run_chunks along with a ChunkFunc that processes it. Each chunk runs
+on a worker thread in its own child interpreter of the calling one (see
+create_child_vm), so blocks can use the caller's words but have their own
+stacks. Whatever a ChunkFunc leaves on its stack is the chunk's result, and the
+results of all chunks are stitched together in the original order. A ChunkFunc
+should stop once its interpreter has an error (see handle_error); if any chunk
+has one, run_chunks drops all of the results, and the caller reports that its
+block failed.
+
+Work that doesn't need an interpreter (e.g., sorting keys for psort) is run
+with run_in_workers.
+
+The calling interpreter waits until every chunk is done, so its dictionary
+doesn't change while the children are reading it. Since the chunks run at the
+same time, a block can't store in the variables the interpreters share ("!" is
+an error unless the block defined the variable itself).
+
+The pool is shared by every interpreter in the process and is created the
+first time it's needed. It has KIT_WORKERS threads (by default, one per
+processor). Jobs started from a worker (e.g., by a pmap in a pmap) run on that
+worker, since waiting for other workers from a worker could deadlock.
+*/
+
+#define CHUNKS_PER_WORKER 4     /**< \brief Chunks per worker, so uneven chunks balance out */
+
+
+static GThreadPool *_worker_pool = NULL;     /**< \brief Shared by all interpreters (guarded by the worker_pool lock) */
+static guint _num_workers = 0;               /**< \brief Threads in the worker pool */
+G_LOCK_DEFINE_STATIC(worker_pool);
+
+static __thread gboolean _in_worker = FALSE; /**< \brief TRUE on the pool's threads */
+
+
+/** \brief Jobs of one call to run_in_workers
+*/
+typedef struct {
+    guint num_pending;          /**< \brief Jobs that aren't done yet */
+    GMutex lock;                /**< \brief Guards num_pending */
+    GCond job_done;             /**< \brief Signaled when a job is done */
+} JobSet;
+
+
+/** \brief A job on its way to the pool
+*/
+typedef struct {
+    WorkerFunc func;
+    gpointer job;               /**< \brief Passed to func */
+    JobSet *job_set;            /**< \brief Set the job reports to when it's done */
+} WorkerTask;
+
+
+/** \brief A chunk of a sequence and the results of processing it
+*/
+typedef struct {
+    KitVM *vm_parent;           /**< \brief Interpreter that called run_chunks */
+    Param **items;              /**< \brief First item of the chunk */
+    guint num_items;            /**< \brief Items in the chunk */
+    ChunkFunc func;
+    gconstpointer data;         /**< \brief Passed to func */
+    GPtrArray *results;         /**< \brief What func left on the stack (bottom first) */
+    gboolean failed;            /**< \brief Set if there was an error in the chunk */
+} Chunk;
+
+
+
+// -----------------------------------------------------------------------------
+/** Runs a job on a worker thread and reports when it's done.
+*/
+// -----------------------------------------------------------------------------
+static void run_worker_task(gpointer gp_task, gpointer gp_unused) {
+    WorkerTask *task = gp_task;
+    JobSet *job_set = task->job_set;
+    _in_worker = TRUE;
+
+    task->func(task->job);
+
+    g_mutex_lock(&job_set->lock);
+    job_set->num_pending--;
+    g_cond_signal(&job_set->job_done);
+    g_mutex_unlock(&job_set->lock);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns the number of worker threads, starting the pool if it isn't running
+    yet.
+*/
+// -----------------------------------------------------------------------------
+guint get_num_workers() {
+    G_LOCK(worker_pool);
+    if (!_worker_pool) {
+        const gchar *num_workers_text = g_getenv("KIT_WORKERS");
+        gint num_workers = num_workers_text ? atoi(num_workers_text) : 0;
+        _num_workers = num_workers > 0 ? num_workers : g_get_num_processors();
+        _worker_pool = g_thread_pool_new(run_worker_task, NULL, _num_workers, FALSE, NULL);
+    }
+    G_UNLOCK(worker_pool);
+    return _num_workers;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Runs jobs on the worker pool and waits until they're all done.
+
+Jobs started from a worker thread are run on that thread, one after another.
+
+\param func: Called once for each job, on any thread
+*/
+// -----------------------------------------------------------------------------
+void run_in_workers(WorkerFunc func, gpointer *jobs, guint num_jobs) {
+    get_num_workers();
+
+    if (_in_worker) {
+        for (guint i=0; i < num_jobs; i++) {
+            func(jobs[i]);
+        }
+        return;
+    }
+
+    JobSet job_set;
+    job_set.num_pending = num_jobs;
+    g_mutex_init(&job_set.lock);
+    g_cond_init(&job_set.job_done);
+
+    WorkerTask *tasks = g_new(WorkerTask, num_jobs);
+    for (guint i=0; i < num_jobs; i++) {
+        tasks[i].func = func;
+        tasks[i].job = jobs[i];
+        tasks[i].job_set = &job_set;
+        g_thread_pool_push(_worker_pool, &tasks[i], NULL);
+    }
+
+    g_mutex_lock(&job_set.lock);
+    while (job_set.num_pending > 0) {
+        g_cond_wait(&job_set.job_done, &job_set.lock);
+    }
+    g_mutex_unlock(&job_set.lock);
+
+    g_cond_clear(&job_set.job_done);
+    g_mutex_clear(&job_set.lock);
+    g_free(tasks);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if a param refers to a word defined in a dictionary.
+
+Quotations and entry addresses are checked, along with the items of sequences
+(e.g., a sequence of quotations).
+*/
+// -----------------------------------------------------------------------------
+static gboolean refers_to_dictionary(const Param *param, const Dictionary *dictionary) {
+    if (!param) return FALSE;
+
+    if (param->type == 'E' || param->type == 'Q') {
+        return param->val_entry->dictionary == dictionary;
+    }
+
+    if (param->type == 'C' && param->val_custom_type->free_custom == free_seq) {
+        FOREACH_SEQ(iter, (GSequence *) param->val_custom) {
+            if (refers_to_dictionary(g_sequence_get(iter), dictionary)) return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Runs a chunk in a new child of the interpreter that called run_chunks.
+*/
+// -----------------------------------------------------------------------------
+static void run_chunk(gpointer gp_chunk) {
+    Chunk *chunk = gp_chunk;
+    KitVM *vm = create_child_vm(chunk->vm_parent);
+    vm->out = chunk->vm_parent->out;
+    vm->err = chunk->vm_parent->err;
+    vm->read_only_vars = TRUE;
+
+    KitVM *vm_prev = use_vm(vm);
+    chunk->func(chunk->items, chunk->num_items, chunk->data);
+
+    // The stack is popped from the top, so the results are filled in backwards
+    guint num_results = get_stack_depth();
+    chunk->results = g_ptr_array_sized_new(num_results);
+    g_ptr_array_set_size(chunk->results, num_results);
+    for (guint i=num_results; i > 0; i--) {
+        g_ptr_array_index(chunk->results, i-1) = pop_param();
+    }
+
+    // Words defined in the chunk's interpreter go away with it
+    for (guint i=0; i < num_results && !vm->error; i++) {
+        if (refers_to_dictionary(g_ptr_array_index(chunk->results, i), vm->dictionary)) {
+            handle_error(ERR_INVALID_PARAM);
+            fprintf(vm->err, "-----> A parallel block can't return a word it defined\n");
+        }
+    }
+    chunk->failed = vm->error;
+
+    use_vm(vm_prev);
+    destroy_vm(vm);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Processes the items of a sequence in chunks on the worker pool.
+
+The calling interpreter waits until every chunk is done.
+
+\param seq: Sequence of Params (it isn't changed)
+\param func: Called in a worker's interpreter for each chunk; leaves the
+             chunk's results on the stack
+\param data: Passed to func
+\returns The results of all chunks, in order (free with g_ptr_array_free), or
+          NULL if there was an error in any chunk (it has been printed)
+*/
+// -----------------------------------------------------------------------------
+GPtrArray *run_chunks(GSequence *seq, ChunkFunc func, gconstpointer data) {
+    guint num_items = g_sequence_get_length(seq);
+    GPtrArray *result = g_ptr_array_new_with_free_func(free_param);
+    if (num_items == 0) return result;
+
+    // Chunks point into a flat array of the items
+    Param **items = g_new(Param *, num_items);
+    guint index = 0;
+    FOREACH_SEQ(iter, seq) {
+        items[index++] = g_sequence_get(iter);
+    }
+
+    guint num_workers = get_num_workers();
+    guint num_chunks = MIN(num_items, num_workers * CHUNKS_PER_WORKER);
+    guint chunk_size = (num_items + num_chunks - 1) / num_chunks;
+    num_chunks = (num_items + chunk_size - 1) / chunk_size;
+
+    Chunk *chunks = g_new0(Chunk, num_chunks);
+    gpointer *jobs = g_new(gpointer, num_chunks);
+    for (guint i=0; i < num_chunks; i++) {
+        Chunk *chunk = &chunks[i];
+        chunk->vm_parent = _vm;
+        chunk->items = items + i * chunk_size;
+        chunk->num_items = MIN(chunk_size, num_items - i * chunk_size);
+        chunk->func = func;
+        chunk->data = data;
+        jobs[i] = chunk;
+    }
+
+    run_in_workers(run_chunk, jobs, num_chunks);
+
+    // Stitch the results together (they're moved, not copied)
+    gboolean failed = FALSE;
+    for (guint i=0; i < num_chunks; i++) {
+        GPtrArray *results = chunks[i].results;
+        for (guint j=0; j < results->len; j++) {
+            g_ptr_array_add(result, g_ptr_array_index(results, j));
+        }
+        g_ptr_array_free(results, TRUE);
+        failed = failed || chunks[i].failed;
+    }
+    if (failed) {
+        g_ptr_array_free(result, TRUE);
+        result = NULL;
+    }
+
+    g_free(jobs);
+    g_free(chunks);
+    g_free(items);
+    return result;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Stops the worker pool (if it was started).
+
+This must be called once no interpreters are running parallel words.
+*/
+// -----------------------------------------------------------------------------
+void destroy_worker_pool() {
+    if (!_worker_pool) return;
+
+    g_thread_pool_free(_worker_pool, FALSE, TRUE);
+    _worker_pool = NULL;
+    _num_workers = 0;
+}
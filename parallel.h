@@ -0,0 +1,19 @@
+/** \file parallel.h
+*/
+
+#pragma once
+
+/** \brief Processes a chunk of a sequence's items in a worker's interpreter,
+    leaving the results on its stack (it should stop if the interpreter has an
+    error)
+*/
+typedef void (*ChunkFunc)(Param **items, guint num_items, gconstpointer data);
+
+/** \brief Does one job of run_in_workers
+*/
+typedef void (*WorkerFunc)(gpointer job);
+
+guint get_num_workers();
+void run_in_workers(WorkerFunc func, gpointer *jobs, guint num_jobs);
+GPtrArray *run_chunks(GSequence *seq, ChunkFunc func, gconstpointer data);
+void destroy_worker_pool();
@@ -8,7 +8,8 @@ params array of an Entry.
 See \ref param_types "Param types" for a description of each type of parameter.
 */
 
-static GHashTable *_custom_print_functions = NULL;
+static GHashTable *_custom_types = NULL;   /**< \brief Shared by all interpreters (guarded by the custom_types lock) */
+G_LOCK_DEFINE_STATIC(custom_types);
 
 // -----------------------------------------------------------------------------
 /** Creates a new Param.
@@ -17,15 +18,120 @@ static GHashTable *_custom_print_functions = NULL;
 */
 // -----------------------------------------------------------------------------
 Param *new_param() {
-    Param *result = g_new(Param, 1);
+    Param *result = slab_new0(Param);
     result->type = '?';
-    result->val_string = NULL;
-    result->val_custom = NULL;
     return result;
 }
 
 
 
+/** \brief Header of a shared, immutable string
+
+Strings too long to store inline in a Param are allocated with this header in
+front of their characters. val_string points at "str", and copies of the Param
+share the same buffer.
+*/
+typedef struct {
+    gint ref_count;     /**< \brief Number of Params sharing the string (atomic) */
+    gsize size;         /**< \brief Allocated size of the header plus string */
+    gchar str[];        /**< \brief NUL-terminated characters */
+} SharedString;
+
+#define SHARED_STRING(_str_) ((SharedString *) ((_str_) - G_STRUCT_OFFSET(SharedString, str)))
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if an 'S' Param's value is a SharedString
+*/
+// -----------------------------------------------------------------------------
+static gboolean has_shared_string(const Param *param) {
+    return param->val_string && param->val_string != param->val_sso;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Stores a copy of the first len characters of a string in a Param.
+
+Strings shorter than PARAM_SSO_LEN are copied into the Param's val_sso buffer.
+Longer strings are copied into a new SharedString.
+*/
+// -----------------------------------------------------------------------------
+static void store_string(Param *param, const gchar *str, gsize len) {
+    if (!str) {
+        param->val_string = NULL;
+        return;
+    }
+
+    gchar *dst;
+    if (len < PARAM_SSO_LEN) {
+        dst = param->val_sso;
+    }
+    else {
+        gsize size = sizeof(SharedString) + len + 1;
+        SharedString *shared = slab_alloc(size);
+        shared->ref_count = 1;
+        shared->size = size;
+        dst = shared->str;
+    }
+
+    memcpy(dst, str, len);
+    dst[len] = '\0';
+    param->val_string = dst;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Gives dst the same string value as src, sharing it if it isn't inline
+*/
+// -----------------------------------------------------------------------------
+static void share_string(Param *dst, const Param *src) {
+    if (!has_shared_string(src)) {
+        store_string(dst, src->val_string, src->val_string ? strlen(src->val_string) : 0);
+        return;
+    }
+
+    g_atomic_int_inc(&SHARED_STRING(src->val_string)->ref_count);
+    dst->val_string = src->val_string;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Drops a reference to a custom payload, freeing it with the last reference
+*/
+// -----------------------------------------------------------------------------
+static void unref_custom_box(CustomBox *box, const CustomType *custom_type) {
+    if (g_atomic_int_dec_and_test(&box->ref_count)) {
+        custom_type->free_custom(box->val_custom);
+        slab_delete(CustomBox, box);
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Frees any memory owned by a Param's value (but not the Param itself)
+*/
+// -----------------------------------------------------------------------------
+static void free_param_value(Param *param) {
+    if (param->type == 'S') {
+        if (has_shared_string(param)) {
+            SharedString *shared = SHARED_STRING(param->val_string);
+            if (g_atomic_int_dec_and_test(&shared->ref_count)) {
+                slab_free(shared, shared->size);
+            }
+        }
+    }
+    else if (param->type == 'C') {
+        unref_custom_box(param->val_box, param->val_custom_type);
+    }
+}
+
+
+
 // -----------------------------------------------------------------------------
 /** Creates a new int-valued Param.
 
@@ -65,9 +171,22 @@ Param *new_double_param(gdouble val_double) {
 */
 // -----------------------------------------------------------------------------
 Param *new_str_param(const gchar *str) {
+    return new_str_param_len(str, str ? strlen(str) : 0);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Creates a new string-valued Param from the first len characters of a string
+
+\param str: String to copy (need not be NUL-terminated)
+\param len: Number of characters to copy
+*/
+// -----------------------------------------------------------------------------
+Param *new_str_param_len(const gchar *str, gsize len) {
     Param *result = new_param();
     result->type = 'S';
-    result->val_string = g_strdup(str);
+    store_string(result, str, len);
     return result;
 }
 
@@ -108,22 +227,16 @@ Param *new_entry_param(Entry *val_entry) {
 
 
 // -----------------------------------------------------------------------------
-/** Creates a new pseudoentry-valued Param.
-
-\param val_routine: Value of the Param being created
-\returns newly allocated Param with the specified pseudoentry value
+/** Creates a new quotation Param
 
-This is used during the compilation of definitions. Pseudo entries are used
-to implement branching during a definition as well as doing things like pushing
-constants from a definition onto the param stack.
+\param val_entry: Anonymous entry with the quotation's compiled code
+\returns newly allocated Param with the specified quotation
 */
 // -----------------------------------------------------------------------------
-Param *new_pseudo_entry_param(const gchar *word, routine_ptr routine) {
+Param *new_quotation_param(Entry *val_entry) {
     Param *result = new_param();
-    result->type = 'P';
-    g_strlcpy(result->val_pseudo_entry.word, word, MAX_WORD_LEN);
-    result->val_pseudo_entry.routine = routine;
-    result->val_pseudo_entry.params = g_sequence_new(free_param);
+    result->type = 'Q';
+    result->val_entry = val_entry;
     return result;
 }
 
@@ -132,67 +245,181 @@ Param *new_pseudo_entry_param(const gchar *word, routine_ptr routine) {
 // -----------------------------------------------------------------------------
 /** Creates a new custom-data valued Param
 
+\param val_custom: Custom data (owned by the new Param)
+\param custom_type: Descriptor for the type of the custom data
 */
 // -----------------------------------------------------------------------------
-Param *new_custom_param(gpointer val_custom, const gchar *custom_type,
-                        free_custom_val_ptr free_custom,
-                        copy_custom_val_ptr copy_custom) {
+Param *new_custom_param(gpointer val_custom, const CustomType *custom_type) {
+    CustomBox *box = slab_new(CustomBox);
+    box->ref_count = 1;
+    box->val_custom = val_custom;
 
     Param *result = new_param();
     result->type = 'C';
     result->val_custom = val_custom;
-    result->free_custom = free_custom;
-    result->copy_custom = copy_custom;
-    g_strlcpy(result->val_custom_type, custom_type, MAX_WORD_LEN);
+    result->val_box = box;
+    result->val_custom_type = custom_type;
     return result;
 }
 
 
 
 // -----------------------------------------------------------------------------
-/** Copies fields of Param to another Param
+/** Ensures a custom Param is the only owner of its payload so it can be modified.
+
+If the payload is shared with other Params, it is copied with copy_custom and
+the Param is switched over to the copy.
+*/
+// -----------------------------------------------------------------------------
+void make_custom_writable(Param *param) {
+    CustomBox *box = param->val_box;
+    if (g_atomic_int_get(&box->ref_count) == 1) {
+        return;
+    }
+
+    CustomBox *box_new = slab_new(CustomBox);
+    box_new->ref_count = 1;
+    box_new->val_custom = param->val_custom_type->copy_custom(box->val_custom);
+
+    param->val_box = box_new;
+    param->val_custom = box_new->val_custom;
+    unref_custom_box(box, param->val_custom_type);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if a Param counts as true (e.g., for "if" or a filter block).
 
-\note The string value is duplicated so that the destination Param can be freed
-      independently of the source Param.
+0, 0.0, and "" are false (as with "not"); everything else is true.
+*/
+// -----------------------------------------------------------------------------
+gboolean is_true_param(const Param *param) {
+    switch(param->type) {
+        case 'I':
+            return param->val_int != 0;
+
+        case 'D':
+            return param->val_double != 0;
+
+        case 'S':
+            return !STR_EQ(param->val_string, "");
+
+        default:
+            return TRUE;
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Copies the value of a Param to another Param
+
+Any value dst already holds is freed first.
+
+\note Long strings and custom payloads are shared and reference counted (short
+      strings are copied inline), so the destination Param can be freed
+      independently of the source Param. Strings are immutable; call
+      make_custom_writable before modifying a custom payload.
 */
 // -----------------------------------------------------------------------------
 void copy_param(Param *dst, const Param *src) {
-    *dst = *src;
+    free_param_value(dst);
+    dst->type = src->type;
+
+    switch(src->type) {
+        case 'I':
+            dst->val_int = src->val_int;
+            break;
+
+        case 'D':
+            dst->val_double = src->val_double;
+            break;
 
-    // Make a copy of the string since the dst needs to own it
-    dst->val_string = g_strdup(src->val_string);
+        case 'S':
+            share_string(dst, src);
+            break;
 
-    if (src->type == 'C') {
-        dst->val_custom = src->copy_custom(src->val_custom);
+        case 'E':
+        case 'Q':
+            dst->val_entry = src->val_entry;
+            break;
+
+        case 'R':
+            dst->val_routine = src->val_routine;
+            break;
+
+        case 'C':
+            // Copies share the payload until one of them needs to modify it
+            g_atomic_int_inc(&src->val_box->ref_count);
+            dst->val_box = src->val_box;
+            dst->val_custom = src->val_custom;
+            dst->val_custom_type = src->val_custom_type;
+            break;
+
+        default:
+            break;
     }
 }
 
 
 
-void create_print_functions() {
-    _custom_print_functions = g_hash_table_new(g_str_hash, g_str_equal);
+// -----------------------------------------------------------------------------
+/** Creates the registry of custom types
+*/
+// -----------------------------------------------------------------------------
+void create_custom_types() {
+    _custom_types = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Registers a custom type descriptor so it can be found by name.
+
+Lexicons call this once for each of their types. The descriptor must outlive
+the registry (usually it's a static variable).
+*/
+// -----------------------------------------------------------------------------
+void add_custom_type(const CustomType *custom_type) {
+    G_LOCK(custom_types);
+    g_hash_table_insert(_custom_types, (gpointer) custom_type->name, (gpointer) custom_type);
+    G_UNLOCK(custom_types);
 }
 
 
 
-void add_print_function(const gchar *type_name, print_param_func func) {
-    g_hash_table_insert(_custom_print_functions, (gpointer) type_name, (gpointer) func);
+// -----------------------------------------------------------------------------
+/** Looks up a registered custom type descriptor by name.
+
+\returns The descriptor or NULL if no type with that name has been registered
+*/
+// -----------------------------------------------------------------------------
+const CustomType *find_custom_type(const gchar *name) {
+    G_LOCK(custom_types);
+    const CustomType *result = g_hash_table_lookup(_custom_types, name);
+    G_UNLOCK(custom_types);
+    return result;
 }
 
 
 
-void destroy_print_functions() {
-    g_hash_table_destroy(_custom_print_functions);
+// -----------------------------------------------------------------------------
+/** Frees the registry of custom types (but not the descriptors themselves)
+*/
+// -----------------------------------------------------------------------------
+void destroy_custom_types() {
+    g_hash_table_destroy(_custom_types);
 }
 
 
 static void print_custom_param(FILE *file, Param* param) {
-    print_param_func p_func = g_hash_table_lookup(_custom_print_functions, param->val_custom_type);
-    if (!p_func) {
-        fprintf(file, "Custom param (%s)\n", param->val_custom_type);
+    const CustomType *custom_type = param->val_custom_type;
+    if (!custom_type->print) {
+        fprintf(file, "Custom param (%s)\n", custom_type->name);
     }
     else {
-        p_func(file, param);
+        custom_type->print(file, param);
     }
 }
 
@@ -231,12 +458,13 @@ void print_param(FILE *file, Param *param) {
             fprintf(file, "Entry: %s\n", entry->word);
             break;
 
-        case 'R':
-            fprintf(file, "Routine: %ld\n", (gint64) param->val_routine);
+        case 'Q':
+            entry = param->val_entry;
+            fprintf(file, "Quotation: %d cells\n", entry->code->len);
             break;
 
-        case 'P':
-            fprintf(file, "Pseudo-entry: %s\n", param->val_pseudo_entry.word);
+        case 'R':
+            fprintf(file, "Routine: %ld\n", (gint64) param->val_routine);
             break;
 
         case 'C':
@@ -267,17 +495,8 @@ void free_param(gpointer gp_param) {
         return;
     }
 
-    if (param->type == 'S') {
-        g_free(param->val_string);
-    }
-    else if (param->type == 'P') {
-        g_sequence_free(param->val_pseudo_entry.params);
-    }
-    else if (param->type == 'C') {
-        param->free_custom(param->val_custom);
-    }
-
-    g_free(param);
+    free_param_value(param);
+    slab_delete(Param, param);
 }
 
 
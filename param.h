@@ -3,9 +3,6 @@
 
 #pragma once
 
-typedef void (*print_param_func)(FILE *file, Param *param);
-
-
 Param *new_param();
 void copy_param(Param *dst, const Param *src);
 void free_param(gpointer param);
@@ -16,15 +13,17 @@ gpointer copy_nop(gpointer val_custom);
 Param *new_int_param(gint64 val_int);
 Param *new_double_param(gdouble val_double);
 Param *new_str_param(const gchar *str);
+Param *new_str_param_len(const gchar *str, gsize len);
 Param *new_entry_param(Entry *val_entry);
+Param *new_quotation_param(Entry *val_entry);
 Param *new_routine_param(routine_ptr val_routine);
-Param *new_pseudo_entry_param(const gchar *word, routine_ptr routine);
-Param *new_custom_param(gpointer val_custom, const gchar *custom_type,
-                        free_custom_val_ptr free_custom,
-                        copy_custom_val_ptr copy_custom);
+Param *new_custom_param(gpointer val_custom, const CustomType *custom_type);
+void make_custom_writable(Param *param);
+gboolean is_true_param(const Param *param);
 
 
-void create_print_functions();
-void add_print_function(const gchar *type_name, print_param_func func);
-void destroy_print_functions();
+void create_custom_types();
+void add_custom_type(const CustomType *custom_type);
+const CustomType *find_custom_type(const gchar *name);
+void destroy_custom_types();
 void print_param(FILE *f, Param *param);
@@ -3,7 +3,13 @@
 \brief Defines functions for creating, manipulating, and freeing the return stack.
 
 The return stack is used to keep track of execution stack frames when definitions
-are executed.
+are executed. It also holds the limits and indexes of running loops (see "do").
+
+The return stack is a contiguous array with a fixed capacity
+(RETURN_STACK_CAPACITY), so pushing and popping slots doesn't allocate.
+Running out of room (e.g., from unbounded recursion that isn't in tail position)
+is reported as ERR_RETURN_STACK_OVERFLOW rather than growing without limit.
+Calls in tail position don't push a frame at all (see OP_TAIL_CALL).
 
 */
 
@@ -13,7 +19,10 @@ are executed.
 */
 // -----------------------------------------------------------------------------
 void create_stack_r() {
-    _return_stack = g_queue_new();
+    _vm->return_stack = g_new(ReturnStack, 1);
+    _vm->return_stack->slots = g_new(ReturnSlot, RETURN_STACK_CAPACITY);
+    _vm->return_stack->depth = 0;
+    _vm->return_stack->capacity = RETURN_STACK_CAPACITY;
 }
 
 
@@ -26,7 +35,7 @@ good initial state.
 */
 // -----------------------------------------------------------------------------
 void clear_stack_r() {
-    g_queue_clear(_return_stack);
+    _vm->return_stack->depth = 0;
 }
 
 
@@ -36,27 +45,103 @@ void clear_stack_r() {
 */
 // -----------------------------------------------------------------------------
 void destroy_stack_r() {
-    g_queue_free(_return_stack);
+    g_free(_vm->return_stack->slots);
+    g_free(_vm->return_stack);
+    _vm->return_stack = NULL;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Pushes an instruction pointer onto the return stack.
+
+\returns FALSE if the return stack is full. The overflow has been handled (which
+         resets the interpreter), so the caller should stop executing.
+*/
+// -----------------------------------------------------------------------------
+gboolean push_param_r(Cell *ip) {
+    if (_vm->return_stack->depth == _vm->return_stack->capacity) {
+        handle_error(ERR_RETURN_STACK_OVERFLOW);
+        fprintf(_vm->err, "-----> More than %d nested calls\n", _vm->return_stack->capacity);
+        return FALSE;
+    }
+
+    _vm->return_stack->slots[_vm->return_stack->depth++].ip = ip;
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Pops an instruction pointer off the return stack.
+
+\returns The instruction pointer or NULL if the return stack is empty
+*/
+// -----------------------------------------------------------------------------
+Cell *pop_param_r() {
+    if (_vm->return_stack->depth == 0) {
+        return NULL;
+    }
+    return _vm->return_stack->slots[--_vm->return_stack->depth].ip;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Pushes the limit and starting index of a loop onto the return stack.
+
+\returns FALSE if the return stack is full (see push_param_r)
+*/
+// -----------------------------------------------------------------------------
+gboolean push_loop_r(gint64 limit, gint64 index) {
+    if (_vm->return_stack->depth + 2 > _vm->return_stack->capacity) {
+        handle_error(ERR_RETURN_STACK_OVERFLOW);
+        fprintf(_vm->err, "-----> Too many nested calls and loops\n");
+        return FALSE;
+    }
+
+    _vm->return_stack->slots[_vm->return_stack->depth++].val_int = limit;
+    _vm->return_stack->slots[_vm->return_stack->depth++].val_int = index;
+    return TRUE;
 }
 
 
 
 // -----------------------------------------------------------------------------
-/** Pushes a param pointer onto the return stack.
+/** Returns the slot with the index of a loop.
+
+\param loop_level: 0 for the innermost loop, 1 for the loop around it, etc.
+\returns The slot (the loop's limit is in the slot below it) or NULL if the
+         return stack isn't that deep
+\note This assumes the loops are running in the current definition. Other
+      slots (e.g., return addresses) are returned as is.
+*/
+// -----------------------------------------------------------------------------
+ReturnSlot *loop_slot_r(guint loop_level) {
+    guint offset = 2 * loop_level + 1;
+    if (_vm->return_stack->depth < offset + 1) {
+        return NULL;
+    }
+    return &_vm->return_stack->slots[_vm->return_stack->depth - offset];
+}
+
 
+
+// -----------------------------------------------------------------------------
+/** Drops the innermost loop's limit and index from the return stack
 */
 // -----------------------------------------------------------------------------
-void push_param_r(GSequenceIter* param) {
-    g_queue_push_tail(_return_stack, param);
+void drop_loop_r() {
+    _vm->return_stack->depth -= 2;
 }
 
 
 
 // -----------------------------------------------------------------------------
-/** Pops a parameter off the return stack.
+/** Returns the number of items on the return stack.
 
 */
 // -----------------------------------------------------------------------------
-GSequenceIter *pop_param_r() {
-    return g_queue_pop_tail(_return_stack);
+guint get_stack_r_depth() {
+    return _vm->return_stack->depth;
 }
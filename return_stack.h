@@ -3,8 +3,13 @@
 
 #pragma once
 
-void push_param_r(GSequenceIter *param_iter);
-GSequenceIter *pop_param_r();
+gboolean push_param_r(Cell *ip);
+Cell *pop_param_r();
+guint get_stack_r_depth();
+
+gboolean push_loop_r(gint64 limit, gint64 index);
+ReturnSlot *loop_slot_r(guint loop_level);
+void drop_loop_r();
 
 void create_stack_r();
 void clear_stack_r();
@@ -0,0 +1,273 @@
+/** \file server.c
+
+\brief Serves interpreter sessions over a Unix domain socket.
+
+Starting kit loads the basic dictionary, the lexicons, and whatever script it
+runs (e.g., tasks.forth opens tasks.db and goes to the last active task). For
+one-line commands, that dominates the time they take.
+
+In server mode (kit --serve socket-path [file]), the file is run once in a
+warm interpreter, and then each connection to the socket is a session:
+
+- The client sends its command text and shuts down its side of the connection.
+- The command runs in a child interpreter of the warm one (see
+  create_child_vm), so it has its own stack and its own definitions but sees
+  all of the warm interpreter's words, variables, and open databases.
+- Everything the command prints (its output and its errors) goes back to the
+  client, and the connection is closed when the command is done.
+
+The server replaces a socket left behind by a server that's no longer running,
+but it won't start if another server answers on the socket or if something
+other than a socket is at its path.
+
+Sessions are served one at a time, which keeps the warm interpreter's
+variables consistent. A ".q" in a session only ends that session (even if the
+warm interpreter redefined ".q"). Words and quotations defined in a session go
+away with it, so they can't be stored in the warm interpreter's variables.
+
+In client mode (kit --client socket-path command...), kit joins its arguments
+into a command, sends it to the server, and copies the output to stdout. The
+client doesn't build a dictionary at all.
+*/
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+
+#define SESSION_BUF_SIZE 4096     /**< \brief Bytes read from a socket at a time */
+
+
+
+// -----------------------------------------------------------------------------
+/** Fills out the address of a Unix domain socket.
+
+\returns FALSE if the path is too long (the error is reported here)
+*/
+// -----------------------------------------------------------------------------
+static gboolean get_socket_address(const gchar *socket_path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (g_strlcpy(addr->sun_path, socket_path, sizeof(addr->sun_path)) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Makes sure a server can bind to a socket path, removing the socket of a
+    server that's no longer running.
+
+\returns FALSE if the path is in use (the reason is printed)
+*/
+// -----------------------------------------------------------------------------
+static gboolean claim_socket_path(const gchar *socket_path, const struct sockaddr_un *addr) {
+    struct stat info;
+    if (lstat(socket_path, &info) != 0) {
+        if (errno == ENOENT) return TRUE;
+        fprintf(stderr, "Unable to check %s: %s\n", socket_path, strerror(errno));
+        return FALSE;
+    }
+
+    if (!S_ISSOCK(info.st_mode)) {
+        fprintf(stderr, "Not a socket: %s\n", socket_path);
+        return FALSE;
+    }
+
+    // If a server answers, it's still running
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return FALSE;
+    }
+    gboolean is_live = connect(fd, (const struct sockaddr *) addr, sizeof(*addr)) == 0;
+    close(fd);
+    if (is_live) {
+        fprintf(stderr, "A server is already running on %s\n", socket_path);
+        return FALSE;
+    }
+
+    if (unlink(socket_path) != 0) {
+        fprintf(stderr, "Unable to remove %s: %s\n", socket_path, strerror(errno));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Writes all of a buffer to a file descriptor.
+
+\returns FALSE if the write fails (e.g., the other side went away)
+*/
+// -----------------------------------------------------------------------------
+static gboolean write_all(int fd, const gchar *buf, gsize len) {
+    while (len > 0) {
+        ssize_t num_written = write(fd, buf, len);
+        if (num_written < 0) {
+            if (errno == EINTR) continue;
+            return FALSE;
+        }
+        buf += num_written;
+        len -= num_written;
+    }
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Reads a session's command: everything the client sends until it shuts
+    down its side of the connection.
+
+\returns A new string (free with g_free) or NULL if the read fails
+*/
+// -----------------------------------------------------------------------------
+static gchar *read_command(int fd) {
+    GString *result = g_string_new(NULL);
+    gchar buf[SESSION_BUF_SIZE];
+
+    while (1) {
+        ssize_t num_read = read(fd, buf, sizeof(buf));
+        if (num_read == 0) break;
+        if (num_read < 0) {
+            if (errno == EINTR) continue;
+            g_string_free(result, TRUE);
+            return NULL;
+        }
+        g_string_append_len(result, buf, num_read);
+    }
+
+    return g_string_free(result, FALSE);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Runs one session's command in a child of the warm interpreter, sending its
+    output to the client.
+*/
+// -----------------------------------------------------------------------------
+static void serve_session(KitVM *vm_warm, int fd_client) {
+    gchar *command = read_command(fd_client);
+    if (!command) return;
+
+    KitVM *vm_session = create_child_vm(vm_warm);
+    KitVM *vm_prev = use_vm(vm_session);
+
+    // The warm interpreter's ".q" may clean up what the sessions share (e.g.,
+    // tasks redefines it to close the database), so sessions get the basic one
+    Entry *entry_quit = find_base_entry(".q");
+    add_entry(".q")->routine = entry_quit->routine;
+
+    // Output and errors both go back to the client, in the order they happen
+    FILE *file_client = fdopen(dup(fd_client), "w");
+    if (file_client) {
+        vm_session->out = file_client;
+        vm_session->err = file_client;
+
+        scan_string(command);
+        run_vm();
+        fclose(file_client);
+    }
+
+    use_vm(vm_prev);
+    destroy_vm(vm_session);
+    g_free(command);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Serves sessions on a Unix domain socket until the process is killed.
+
+The thread's interpreter is the warm interpreter for the sessions, so it
+should already have run its startup file.
+
+\returns 0, or 1 if the socket can't be set up
+*/
+// -----------------------------------------------------------------------------
+int serve(const gchar *socket_path) {
+    struct sockaddr_un addr;
+    if (!get_socket_address(socket_path, &addr)) return 1;
+    if (!claim_socket_path(socket_path, &addr)) return 1;
+
+    int fd_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd_listen < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    if (bind(fd_listen, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(fd_listen, SOMAXCONN) != 0) {
+        fprintf(stderr, "Unable to listen on %s: %s\n", socket_path, strerror(errno));
+        close(fd_listen);
+        return 1;
+    }
+
+    // A client that goes away shouldn't take the server with it
+    signal(SIGPIPE, SIG_IGN);
+
+    KitVM *vm_warm = _vm;
+    while (1) {
+        int fd_client = accept(fd_listen, NULL, NULL);
+        if (fd_client < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+
+        serve_session(vm_warm, fd_client);
+        close(fd_client);
+    }
+
+    close(fd_listen);
+    unlink(socket_path);
+    return 0;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Sends a command to a server and copies its output to stdout.
+
+\returns 0, or 1 if the server can't be reached
+*/
+// -----------------------------------------------------------------------------
+int run_client(const gchar *socket_path, const gchar *command) {
+    struct sockaddr_un addr;
+    if (!get_socket_address(socket_path, &addr)) return 1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Unable to connect to %s: %s\n", socket_path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return 1;
+    }
+
+    // The server runs the command once it sees the end of it
+    gboolean ok = write_all(fd, command, strlen(command));
+    shutdown(fd, SHUT_WR);
+
+    gchar buf[SESSION_BUF_SIZE];
+    while (ok) {
+        ssize_t num_read = read(fd, buf, sizeof(buf));
+        if (num_read == 0) break;
+        if (num_read < 0) {
+            if (errno == EINTR) continue;
+            ok = FALSE;
+            break;
+        }
+        ok = write_all(STDOUT_FILENO, buf, num_read);
+    }
+
+    close(fd);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,7 @@
+/** \file server.h
+*/
+
+#pragma once
+
+int serve(const gchar *socket_path);
+int run_client(const gchar *socket_path, const gchar *command);
@@ -0,0 +1,157 @@
+/** \file specialize.c
+
+\brief Builds versions of definitions specialized for integer inputs.
+
+Most numeric definitions only ever see integers, but each arithmetic word still
+checks the types of its operands. A verified definition (see stack_effect.c)
+whose cells all make integers from integers gets a second version of its code,
+int_code, where:
+
+- integer literals are pushed without copying a Param (OP_INT_LITERAL)
+- +, -, *, and the comparisons are done inline (e.g., OP_INT_ADD)
+- conditional jumps don't check the type of the flag (OP_INT_JMP_IF_FALSE)
+- calls to other definitions with integer code go straight to it (OP_INT_CALL)
+
+Other integer words (like "/", which checks for division by 0) are still
+called. Any other cell (e.g., a string literal or a call to "@") means the
+definition doesn't get integer code.
+
+When a definition with integer code is entered, the inner interpreter checks
+that its inputs are all integers. If they are, it runs the integer code, which
+can only make more integers, so no other checks are needed. If not, it falls
+back to the generic code.
+
+When built with KIT_NO_SPECIALIZE (configure with --disable-specialize), no
+integer code is built.
+*/
+
+
+
+// -----------------------------------------------------------------------------
+/** Sets a cell to push an integer
+*/
+// -----------------------------------------------------------------------------
+static void set_int_literal(Cell *cell, gint64 val_int) {
+    cell->op = OP_INT_LITERAL;
+    cell->val_int = val_int;
+    cell->literal = NULL;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Sets a cell to call an integer word (or a stack word).
+
+\returns FALSE if the entry might not make integers from integers
+*/
+// -----------------------------------------------------------------------------
+static gboolean set_int_call(Cell *cell, Entry *entry) {
+    CellOp int_op = get_unchecked_op(entry);
+    if (entry->int_code) {
+        int_op = OP_INT_CALL;
+    }
+    else if (int_op == OP_CALL && !get_int_op(entry, &int_op)) {
+        return FALSE;
+    }
+
+    cell->op = int_op;
+    cell->entry = entry;
+    cell->literal = NULL;
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Gets the cells that replace a cell in integer code.
+
+\param dst: Gets up to two cells
+\returns The number of cells (0 if the cell might not make integers from integers)
+*/
+// -----------------------------------------------------------------------------
+static guint specialize_cell(const Cell *cell, Cell *dst) {
+    dst[0] = *cell;
+
+    switch(cell->op) {
+        case OP_JMP:
+        case OP_RETURN:
+        case OP_DO:
+        case OP_LOOP:
+        case OP_LOOP_INDEX:
+        case OP_DUP:
+        case OP_SWAP:
+        case OP_DROP:
+            return 1;
+
+        case OP_JMP_IF_FALSE:
+            dst[0].op = OP_INT_JMP_IF_FALSE;
+            return 1;
+
+        case OP_TAIL_CALL:
+            // Tail calls keep checking their inputs, but they have to have integer code
+            return cell->entry->int_code ? 1 : 0;
+
+        case OP_CALL:
+            return set_int_call(&dst[0], cell->entry) ? 1 : 0;
+
+        case OP_PUSH_LITERAL:
+            if (cell->literal->type != 'I') return 0;
+            set_int_literal(&dst[0], cell->literal->val_int);
+            return 1;
+
+        case OP_LITERAL_CALL:
+            if (cell->literal->type != 'I') return 0;
+            set_int_literal(&dst[0], cell->literal->val_int);
+            return set_int_call(&dst[1], cell->entry) ? 2 : 0;
+
+        default:
+            return 0;
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Builds integer code for a verified entry if all of its cells allow it.
+
+This must be called after verify_stack_effect. Since the integer code is only
+used when a definition's inputs are integers, entries whose effect is unknown
+are left alone.
+*/
+// -----------------------------------------------------------------------------
+void specialize_entry(Entry *entry) {
+#ifndef KIT_NO_SPECIALIZE
+    if (!entry->code || !entry->effect.known) return;
+
+    GArray *code = entry->code;
+    GArray *int_code = g_array_sized_new(FALSE, TRUE, sizeof(Cell), code->len);
+    guint *new_index = g_new(guint, code->len + 1);
+
+    for (guint i=0; i < code->len; i++) {
+        new_index[i] = int_code->len;
+
+        Cell cells[2];
+        guint num_cells = specialize_cell(&g_array_index(code, Cell, i), cells);
+        if (num_cells == 0) {
+            g_array_free(int_code, TRUE);
+            g_free(new_index);
+            return;
+        }
+        g_array_append_vals(int_code, cells, num_cells);
+    }
+    new_index[code->len] = int_code->len;
+
+    // Splitting literal calls moves cells, so jumps are retargeted
+    for (guint i=0; i < code->len; i++) {
+        const Cell *cell = &g_array_index(code, Cell, i);
+        if (cell->op != OP_JMP && cell->op != OP_JMP_IF_FALSE &&
+            cell->op != OP_DO && cell->op != OP_LOOP) continue;
+
+        Cell *int_cell = &g_array_index(int_code, Cell, new_index[i]);
+        int_cell->jmp_offset = (gint64) new_index[i + cell->jmp_offset] - new_index[i];
+    }
+
+    g_free(new_index);
+    entry->int_code = int_code;
+#endif
+}
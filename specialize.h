@@ -0,0 +1,6 @@
+/** \file specialize.h
+*/
+
+#pragma once
+
+void specialize_entry(Entry *entry);
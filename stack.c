@@ -5,10 +5,83 @@
 The parameter stack is used to pass arguments and results between words and entry
 routines.
 
-The Param objects on the stack are dynamically allocated. Clients who pop items
-off the stack are responsible for freeing them. Any items left on the stack are
-automatically freed when the stack is cleared or destroyed.
+The stack is a contiguous, growable array of StackCell objects. Integers,
+doubles, entries, quotations, and sequence starts are stored inline in their
+cells, so pushing and popping them doesn't allocate. All other values are boxed
+in a dynamically allocated Param that is owned by the stack.
+
+push_param, pop_param, and top work in terms of Param objects as before.
+Clients who pop items off the stack are responsible for freeing them. Any items
+left on the stack are automatically freed when the stack is cleared or destroyed.
+
+Words that only deal with numbers should use push_int, push_double, and
+stack_cell instead to avoid the Param allocations.
+*/
+
+#define INITIAL_STACK_CAPACITY 64
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns TRUE if a value of the specified type is stored inline in a StackCell
+*/
+// -----------------------------------------------------------------------------
+gboolean is_inline_type(gchar type) {
+    switch(type) {
+        case 'I':
+        case 'D':
+        case 'E':
+        case 'Q':
+        case '[':
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Fills out a Param with the value of an inline cell
 */
+// -----------------------------------------------------------------------------
+static void inline_cell_to_param(Param *dst, const StackCell *cell) {
+    dst->type = cell->type;
+
+    switch(cell->type) {
+        case 'I':
+            dst->val_int = cell->val_int;
+            break;
+
+        case 'D':
+            dst->val_double = cell->val_double;
+            break;
+
+        case 'E':
+        case 'Q':
+            dst->val_entry = cell->val_entry;
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Makes room for one more cell and returns it
+*/
+// -----------------------------------------------------------------------------
+static StackCell *push_cell() {
+    if (_vm->stack->depth == _vm->stack->capacity) {
+        _vm->stack->capacity *= 2;
+        _vm->stack->cells = g_renew(StackCell, _vm->stack->cells, _vm->stack->capacity);
+    }
+    return &_vm->stack->cells[_vm->stack->depth++];
+}
+
 
 
 // -----------------------------------------------------------------------------
@@ -16,17 +89,27 @@ automatically freed when the stack is cleared or destroyed.
 */
 // -----------------------------------------------------------------------------
 void create_stack() {
-    _stack = g_queue_new();
+    _vm->stack = g_new(Stack, 1);
+    _vm->stack->depth = 0;
+    _vm->stack->capacity = INITIAL_STACK_CAPACITY;
+    _vm->stack->cells = g_new(StackCell, _vm->stack->capacity);
 }
 
 
 
 // -----------------------------------------------------------------------------
-/** Helper function used to free a parameter
+/** Pops n cells off the stack, freeing any boxed Param objects
 */
 // -----------------------------------------------------------------------------
-static void _free_param(gpointer param, gpointer unused) {
-    free_param(param);
+void drop_cells(guint n) {
+    if (n > _vm->stack->depth) n = _vm->stack->depth;
+
+    for (guint i=0; i < n; i++) {
+        StackCell *cell = &_vm->stack->cells[--_vm->stack->depth];
+        if (!is_inline_type(cell->type)) {
+            free_param(cell->val_param);
+        }
+    }
 }
 
 
@@ -36,8 +119,7 @@ static void _free_param(gpointer param, gpointer unused) {
 */
 // -----------------------------------------------------------------------------
 void clear_stack() {
-    g_queue_foreach(_stack, _free_param, NULL);
-    g_queue_clear(_stack);
+    drop_cells(_vm->stack->depth);
 }
 
 
@@ -50,7 +132,71 @@ The stack is cleared and all Param objects on the stack are freed as well.
 // -----------------------------------------------------------------------------
 void destroy_stack() {
     clear_stack();
-    g_queue_free(_stack);
+    g_free(_vm->stack->cells);
+    g_free(_vm->stack);
+    _vm->stack = NULL;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns the number of items on the stack
+*/
+// -----------------------------------------------------------------------------
+guint get_stack_depth() {
+    return _vm->stack->depth;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns the cell n items down from the top of the stack (0 is the top).
+
+\returns The cell or NULL if the stack isn't deep enough
+\note The pointer is only valid until the next push.
+*/
+// -----------------------------------------------------------------------------
+StackCell *stack_cell(guint n) {
+    if (n >= _vm->stack->depth) {
+        return NULL;
+    }
+    return &_vm->stack->cells[_vm->stack->depth - 1 - n];
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Pushes an int onto the stack without allocating a Param.
+*/
+// -----------------------------------------------------------------------------
+void push_int(gint64 val_int) {
+    StackCell *cell = push_cell();
+    cell->type = 'I';
+    cell->val_int = val_int;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Pushes a double onto the stack without allocating a Param.
+*/
+// -----------------------------------------------------------------------------
+void push_double(gdouble val_double) {
+    StackCell *cell = push_cell();
+    cell->type = 'D';
+    cell->val_double = val_double;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Pushes an entry address onto the stack without allocating a Param.
+*/
+// -----------------------------------------------------------------------------
+void push_entry(Entry *entry) {
+    StackCell *cell = push_cell();
+    cell->type = 'E';
+    cell->val_entry = entry;
 }
 
 
@@ -58,10 +204,93 @@ void destroy_stack() {
 // -----------------------------------------------------------------------------
 /** Pushes a param onto the stack.
 
+If the param's value can be stored inline, the param is freed.
 */
 // -----------------------------------------------------------------------------
 void push_param(Param* param) {
-    g_queue_push_tail(_stack, param);
+    StackCell *cell = push_cell();
+
+    if (!is_inline_type(param->type)) {
+        cell->type = param->type;
+        cell->val_param = param;
+        return;
+    }
+
+    cell->type = param->type;
+    switch(param->type) {
+        case 'I':
+            cell->val_int = param->val_int;
+            break;
+
+        case 'D':
+            cell->val_double = param->val_double;
+            break;
+
+        case 'E':
+        case 'Q':
+            cell->val_entry = param->val_entry;
+            break;
+
+        default:
+            break;
+    }
+    free_param(param);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Pushes a copy of a param onto the stack.
+
+Inline values are copied straight into a cell; boxed values are deep copied.
+*/
+// -----------------------------------------------------------------------------
+void push_param_copy(const Param *param) {
+    switch(param->type) {
+        case 'I':
+            push_int(param->val_int);
+            break;
+
+        case 'D':
+            push_double(param->val_double);
+            break;
+
+        case 'E':
+            push_entry(param->val_entry);
+            break;
+
+        case 'Q': {
+            StackCell *cell = push_cell();
+            cell->type = 'Q';
+            cell->val_entry = param->val_entry;
+            break;
+        }
+
+        default: {
+            COPY_PARAM(param_new, param);
+            push_param(param_new);
+            break;
+        }
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Pushes a copy of a stack cell onto the stack.
+
+\note cell may point into the stack itself (e.g., for "dup")
+*/
+// -----------------------------------------------------------------------------
+void push_cell_copy(const StackCell *cell) {
+    if (is_inline_type(cell->type)) {
+        StackCell value = *cell;
+        *push_cell() = value;
+    }
+    else {
+        Param *param = cell->val_param;
+        push_param_copy(param);
+    }
 }
 
 
@@ -69,15 +298,24 @@ void push_param(Param* param) {
 // -----------------------------------------------------------------------------
 /** Pops a parameter off the stack.
 
+Inline values are boxed into a newly allocated Param.
+
 \note The caller of this is responsible for freeing the param when done with it.
 */
 // -----------------------------------------------------------------------------
 Param *pop_param() {
-    if (g_queue_is_empty(_stack)) {
+    if (_vm->stack->depth == 0) {
         return NULL;
     }
 
-    return g_queue_pop_tail(_stack);
+    StackCell *cell = &_vm->stack->cells[--_vm->stack->depth];
+    if (!is_inline_type(cell->type)) {
+        return cell->val_param;
+    }
+
+    Param *result = new_param();
+    inline_cell_to_param(result, cell);
+    return result;
 }
 
 
@@ -85,8 +323,33 @@ Param *pop_param() {
 // -----------------------------------------------------------------------------
 /** Returns top of stack so caller can peek at it.
 
+\returns The top Param or NULL if the stack is empty
+\note For inline values, this is a shared scratch Param that is only valid
+      until the next call to top().
 */
 // -----------------------------------------------------------------------------
 const Param *top() {
-    return g_queue_peek_tail(_stack);
+    StackCell *cell = stack_cell(0);
+    if (!cell) {
+        return NULL;
+    }
+    return cell_param(cell, &_vm->top_scratch);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Returns a cell's value as a Param, using scratch for inline values.
+
+This lets callers use Param-based functions (like print_param) on a cell
+without allocating.
+*/
+// -----------------------------------------------------------------------------
+const Param *cell_param(const StackCell *cell, Param *scratch) {
+    if (!is_inline_type(cell->type)) {
+        return cell->val_param;
+    }
+
+    inline_cell_to_param(scratch, cell);
+    return scratch;
 }
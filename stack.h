@@ -7,6 +7,28 @@ void push_param(Param *param);
 Param *pop_param();
 const Param *top();
 
+void push_int(gint64 val_int);
+void push_double(gdouble val_double);
+void push_entry(Entry *entry);
+void push_param_copy(const Param *param);
+void push_cell_copy(const StackCell *cell);
+gboolean is_inline_type(gchar type);
+StackCell *stack_cell(guint n);
+const Param *cell_param(const StackCell *cell, Param *scratch);
+void drop_cells(guint n);
+
+/** Returns the cell n items down from the top of the stack without checking
+    the depth. Only use this where the depth is known (see stack_effect.c).
+*/
+#define STACK_CELL_UNCHECKED(_n_)  (&_vm->stack->cells[_vm->stack->depth - 1 - (_n_)])
+
+/** Pops n inline cells (e.g., integers) without checking the depth or freeing
+    anything. Only use this where the cells are known to be inline.
+*/
+#define DROP_INLINE_CELLS_UNCHECKED(_n_)  (_vm->stack->depth -= (_n_))
+
+guint get_stack_depth();
+
 void create_stack();
 void clear_stack();
 void destroy_stack();
@@ -0,0 +1,288 @@
+/** \file stack_effect.c
+
+\brief Infers and verifies the stack effects of compiled definitions.
+
+Primitives declare their stack effects when they're added to the dictionary
+(see declare_effect). When a definition is compiled, its cells are walked,
+following every branch, to track how many values are on the stack at each cell
+relative to when the definition was entered. If every path through the
+definition leaves the same number of values, the definition's effect is:
+
+- num_in: the most values any path reaches below its starting depth
+- num_out: the values left when it returns, plus num_in
+
+If a cell calls a word whose effect is unknown, the definition's effect is
+unknown too, which is fine. If two paths reach the same cell (or return) with
+different depths, the definition is unbalanced (e.g., an "if" without an "else"
+that pushes a value), and the problem is reported when the definition ends.
+
+Once a definition is verified, the stack can't underflow while it runs as long
+as it has num_in values when it starts. The inner interpreter checks this once
+when the definition is entered, and calls to dup, swap, and pop are replaced
+with ops that don't check the stack depth (see \ref cell_ops "Cell ops").
+Calls to "drop" are left alone since it doesn't free what it drops.
+*/
+
+#define UNREACHED_DEPTH G_MININT    /**< \brief Depth of a cell that no path has reached */
+
+
+
+// -----------------------------------------------------------------------------
+/** Gets the stack effect of a cell that doesn't jump or return.
+
+\returns FALSE if the cell's effect is unknown
+*/
+// -----------------------------------------------------------------------------
+static gboolean get_cell_effect(const Cell *cell, StackEffect *effect) {
+    effect->known = 1;
+    effect->num_in = 0;
+    effect->num_out = 0;
+
+    switch(cell->op) {
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            *effect = cell->entry->effect;
+            return effect->known;
+
+        case OP_LITERAL_CALL:
+            // The literal satisfies one of the entry's inputs
+            if (!cell->entry->effect.known) return FALSE;
+            *effect = cell->entry->effect;
+            if (effect->num_in > 0) {
+                effect->num_in--;
+            }
+            else {
+                effect->num_out++;
+            }
+            return TRUE;
+
+        case OP_PUSH_LITERAL:
+        case OP_FETCH_VARIABLE:
+        case OP_LOOP_INDEX:
+            effect->num_out = 1;
+            return TRUE;
+
+        case OP_GET_FIELD:
+            effect->num_in = 1;
+            effect->num_out = 1;
+            return TRUE;
+
+        case OP_DUP:
+            effect->num_in = 1;
+            effect->num_out = 2;
+            return TRUE;
+
+        case OP_SWAP:
+            effect->num_in = 2;
+            effect->num_out = 2;
+            return TRUE;
+
+        case OP_DROP:
+            effect->num_in = 1;
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+
+
+/** \brief State of the walk through a definition's cells
+*/
+typedef struct {
+    GArray *code;               /**< \brief Cells being walked */
+    gint *depths;               /**< \brief Depth at the start of each cell (or UNREACHED_DEPTH) */
+    GArray *pending;            /**< \brief Indexes of cells whose successors haven't been walked */
+    gint min_depth;             /**< \brief Lowest depth reached (0 or negative) */
+    gint return_depth;          /**< \brief Depth at the returns (or UNREACHED_DEPTH) */
+    const gchar *problem;       /**< \brief Why the definition is unbalanced (NULL if it isn't) */
+} EffectWalk;
+
+
+
+// -----------------------------------------------------------------------------
+/** Records that a cell is reached with the specified depth.
+*/
+// -----------------------------------------------------------------------------
+static void reach_cell(EffectWalk *walk, gint64 index, gint depth) {
+    if (index < 0 || index >= (gint64) walk->code->len) {
+        walk->problem = "A jump leaves the definition";
+        return;
+    }
+
+    if (walk->depths[index] == UNREACHED_DEPTH) {
+        walk->depths[index] = depth;
+        guint pending_index = index;
+        g_array_append_val(walk->pending, pending_index);
+    }
+    else if (walk->depths[index] != depth) {
+        walk->problem = "Branches leave different numbers of values on the stack";
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Records that the definition returns with the specified depth.
+*/
+// -----------------------------------------------------------------------------
+static void reach_return(EffectWalk *walk, gint depth) {
+    if (walk->return_depth == UNREACHED_DEPTH) {
+        walk->return_depth = depth;
+    }
+    else if (walk->return_depth != depth) {
+        walk->problem = "Returns leave different numbers of values on the stack";
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Pops values at the current depth, tracking the lowest depth reached.
+
+\returns The new depth
+*/
+// -----------------------------------------------------------------------------
+static gint pop_values(EffectWalk *walk, gint depth, guint num_values) {
+    depth -= num_values;
+    if (depth < walk->min_depth) {
+        walk->min_depth = depth;
+    }
+    return depth;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Walks every path through an entry's code.
+
+\returns FALSE if the effect of a cell is unknown (walk->problem is set if the
+         definition is unbalanced)
+*/
+// -----------------------------------------------------------------------------
+static gboolean walk_code(EffectWalk *walk) {
+    reach_cell(walk, 0, 0);
+
+    while (walk->pending->len > 0 && !walk->problem) {
+        guint index = g_array_index(walk->pending, guint, walk->pending->len - 1);
+        g_array_set_size(walk->pending, walk->pending->len - 1);
+
+        const Cell *cell = &g_array_index(walk->code, Cell, index);
+        gint depth = walk->depths[index];
+        StackEffect effect;
+
+        switch(cell->op) {
+            case OP_RETURN:
+                reach_return(walk, depth);
+                break;
+
+            case OP_JMP:
+                reach_cell(walk, index + cell->jmp_offset, depth);
+                break;
+
+            case OP_JMP_IF_FALSE:
+                depth = pop_values(walk, depth, 1);
+                reach_cell(walk, index + 1, depth);
+                reach_cell(walk, index + cell->jmp_offset, depth);
+                break;
+
+            case OP_DO:
+                depth = pop_values(walk, depth, 2);
+                reach_cell(walk, index + 1, depth);
+                reach_cell(walk, index + cell->jmp_offset, depth);
+                break;
+
+            case OP_LOOP:
+                // Going around again must leave the stack as the body found it
+                reach_cell(walk, index + cell->jmp_offset, depth);
+                reach_cell(walk, index + 1, depth);
+                break;
+
+            default:
+                if (!get_cell_effect(cell, &effect)) return FALSE;
+                depth = pop_values(walk, depth, effect.num_in) + effect.num_out;
+
+                if (cell->op == OP_TAIL_CALL) {
+                    reach_return(walk, depth);
+                }
+                else {
+                    reach_cell(walk, index + 1, depth);
+                }
+                break;
+        }
+    }
+
+    return !walk->problem && walk->return_depth != UNREACHED_DEPTH;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Gets the op that replaces a call to an entry in a verified definition.
+
+\returns OP_DUP, OP_SWAP, or OP_DROP, or OP_CALL if the entry isn't a stack word
+*/
+// -----------------------------------------------------------------------------
+CellOp get_unchecked_op(const Entry *entry) {
+    if (entry->routine == EC_dup) return OP_DUP;
+    if (entry->routine == EC_swap) return OP_SWAP;
+    if (entry->routine == EC_pop) return OP_DROP;
+    return OP_CALL;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Replaces calls to stack words with ops that don't check the stack depth.
+*/
+// -----------------------------------------------------------------------------
+static void use_unchecked_ops(Entry *entry) {
+    for (guint i=0; i < entry->code->len; i++) {
+        Cell *cell = &g_array_index(entry->code, Cell, i);
+        if (cell->op != OP_CALL) continue;
+
+        cell->op = get_unchecked_op(cell->entry);
+    }
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Infers the stack effect of a compiled entry.
+
+If the effect can be inferred, it's stored in entry->effect, and the entry's
+code is switched to unchecked stack ops.
+
+\param entry: A complete entry (its code ends with OP_RETURN)
+\returns NULL, or a description of the problem if the entry is unbalanced
+*/
+// -----------------------------------------------------------------------------
+const gchar *verify_stack_effect(Entry *entry) {
+    entry->effect.known = 0;
+    entry->effect.num_in = 0;
+    entry->effect.num_out = 0;
+    if (!entry->code) return NULL;
+
+    EffectWalk walk;
+    walk.code = entry->code;
+    walk.depths = g_new(gint, entry->code->len);
+    for (guint i=0; i < entry->code->len; i++) {
+        walk.depths[i] = UNREACHED_DEPTH;
+    }
+    walk.pending = g_array_new(FALSE, FALSE, sizeof(guint));
+    walk.min_depth = 0;
+    walk.return_depth = UNREACHED_DEPTH;
+    walk.problem = NULL;
+
+    if (walk_code(&walk)) {
+        entry->effect.known = 1;
+        entry->effect.num_in = -walk.min_depth;
+        entry->effect.num_out = walk.return_depth - walk.min_depth;
+        use_unchecked_ops(entry);
+    }
+
+    g_array_free(walk.pending, TRUE);
+    g_free(walk.depths);
+    return walk.problem;
+}
@@ -0,0 +1,7 @@
+/** \file stack_effect.h
+*/
+
+#pragma once
+
+const gchar *verify_stack_effect(Entry *entry);
+CellOp get_unchecked_op(const Entry *entry);
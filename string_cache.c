@@ -0,0 +1,247 @@
+/** \file string_cache.c
+
+\brief Caches compiled code for strings passed to execute_string.
+
+Sequence words like map, filter, and sort run the same Forth string once per
+element. Instead of lexing the string and looking up each of its words every
+time, the string is compiled into the code of an anonymous Entry the first time
+it is seen, and that code is executed directly after that.
+
+Strings are only cached if compiling them is equivalent to interpreting them.
+Strings with unknown words, immediate words, or words that read the input
+stream (like ":") are remembered as uncacheable and interpreted as before.
+Quotations ("[: ... ;]") are the exception: like in definitions, they're
+compiled once and pushed as literals, rather than making a new quotation each
+time the string runs.
+
+Cached code refers to dictionary entries directly, so it is stale as soon as
+the dictionary changes. Each cached string records the dictionary generation it
+was compiled in and is recompiled when that no longer matches.
+
+Since a cached string may be executing when it is evicted (e.g., a map string
+that defines a word), evicted entries are retired and only freed once no cached
+string is executing.
+
+Each interpreter has its own cache (see KitVM), since cached code refers to the
+entries in its dictionary.
+*/
+
+#define MAX_CACHED_STRINGS 4096     /**< \brief The cache is cleared when it reaches this size */
+
+
+/** \brief Compiled code for a string
+*/
+typedef struct {
+    Entry *entry;               /**< \brief Anonymous entry with the compiled code (NULL if uncacheable) */
+    guint generation;           /**< \brief Dictionary generation the string was compiled in */
+} CachedString;
+
+
+/** \brief Cached strings of an interpreter
+*/
+struct StringCache {
+    GHashTable *strings;        /**< \brief Maps strings to CachedString objects */
+    GSList *retired_entries;    /**< \brief Evicted entries waiting to be freed */
+    guint executing_depth;      /**< \brief Number of cached strings currently executing */
+
+    guint64 num_hits;
+    guint64 num_compiles;
+    guint64 num_uncacheable;
+    guint64 num_clears;
+};
+
+
+
+// -----------------------------------------------------------------------------
+/** Frees retired entries if no cached string is executing
+*/
+// -----------------------------------------------------------------------------
+static void free_retired_entries(StringCache *cache) {
+    if (cache->executing_depth > 0) return;
+
+    g_slist_free_full(cache->retired_entries, free_entry);
+    cache->retired_entries = NULL;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Frees a CachedString, retiring its entry.
+
+Strings are only removed from the running interpreter's cache.
+*/
+// -----------------------------------------------------------------------------
+static void free_cached_string(gpointer gp_cached) {
+    CachedString *cached = gp_cached;
+    if (cached->entry) {
+        StringCache *cache = _vm->string_cache;
+        cache->retired_entries = g_slist_prepend(cache->retired_entries, cached->entry);
+    }
+    g_free(cached);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Sets up the interpreter's string cache. This must be called before anything
+    calls execute_string.
+*/
+// -----------------------------------------------------------------------------
+void create_string_cache() {
+    StringCache *cache = g_new0(StringCache, 1);
+    cache->strings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_cached_string);
+    _vm->string_cache = cache;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Frees the interpreter's string cache and all compiled strings.
+
+This must be called before the interpreter's dictionary is destroyed.
+*/
+// -----------------------------------------------------------------------------
+void destroy_string_cache() {
+    StringCache *cache = _vm->string_cache;
+    g_hash_table_destroy(cache->strings);
+
+    cache->executing_depth = 0;
+    free_retired_entries(cache);
+    g_free(cache);
+    _vm->string_cache = NULL;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Compiles a string into the code of a new anonymous entry.
+
+The string's tokens are always read through to the end so the input stream is
+left as it was.
+
+\returns The new entry or NULL if the string can't be compiled
+*/
+// -----------------------------------------------------------------------------
+static Entry *compile_string(const gchar *str) {
+    Entry *result = new_entry();
+    g_strlcpy(result->word, "(string)", MAX_WORD_LEN);
+    result->routine = EC_execute;
+
+    gboolean cacheable = TRUE;
+    Entry *entry;
+
+    // Tokens go into the innermost open quotation (or the result)
+    begin_compiling_into(result);
+    scan_string(str);
+    while(1) {
+        Token token = get_token();
+
+        if (token.type == EOF) break;
+        if (token.type == '^') break;   // If EOS, we're done
+        if (!cacheable) continue;
+
+        switch(token.type) {
+            case 'W':
+                entry = find_entry(token.word);
+                if (!entry || entry->parsing || (entry->immediate && !is_quotation_word(entry))) {
+                    cacheable = FALSE;
+                    continue;
+                }
+                break;
+
+            case 'I':
+            case 'D':
+            case 'S':
+                break;
+
+            default:
+                cacheable = FALSE;
+                continue;
+        }
+
+        compile(token);
+    }
+
+    if (!end_compiling_into(result)) {
+        cacheable = FALSE;
+    }
+
+    if (!cacheable) {
+        free_entry(result);
+        return NULL;
+    }
+
+    add_entry_cell(result, OP_RETURN);
+    optimize_entry(result);
+    verify_stack_effect(result);
+    specialize_entry(result);
+    return result;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Executes the compiled code for a string, compiling it if needed.
+
+\param str: Forth string (after macro substitution)
+\returns TRUE if the string was executed; FALSE if it can't be cached and must
+         be interpreted instead
+*/
+// -----------------------------------------------------------------------------
+gboolean execute_cached_string(const gchar *str) {
+    StringCache *cache = _vm->string_cache;
+    guint generation = get_dictionary_generation();
+    CachedString *cached = g_hash_table_lookup(cache->strings, str);
+
+    if (cached && cached->generation != generation) {
+        g_hash_table_remove(cache->strings, str);
+        cached = NULL;
+    }
+
+    if (!cached) {
+        if (g_hash_table_size(cache->strings) >= MAX_CACHED_STRINGS) {
+            g_hash_table_remove_all(cache->strings);
+            cache->num_clears++;
+        }
+
+        cached = g_new(CachedString, 1);
+        cached->entry = compile_string(str);
+        cached->generation = generation;
+        g_hash_table_insert(cache->strings, g_strdup(str), cached);
+        cache->num_compiles++;
+    }
+    else if (cached->entry) {
+        cache->num_hits++;
+    }
+
+    if (!cached->entry) {
+        cache->num_uncacheable++;
+        return FALSE;
+    }
+
+    // The entry may be evicted while it runs, so hang on to it until it's done
+    Entry *entry = cached->entry;
+    cache->executing_depth++;
+    execute(entry);
+    cache->executing_depth--;
+
+    free_retired_entries(cache);
+    return TRUE;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Prints the interpreter's string cache counters
+*/
+// -----------------------------------------------------------------------------
+void print_string_cache_stats(FILE *file) {
+    StringCache *cache = _vm->string_cache;
+    fprintf(file, "%12s %12s %12s %8s %8s\n", "hits", "compiles", "uncacheable", "strings", "clears");
+    fprintf(file, "%12ld %12ld %12ld %8d %8ld\n",
+            cache->num_hits,
+            cache->num_compiles,
+            cache->num_uncacheable,
+            g_hash_table_size(cache->strings),
+            cache->num_clears);
+}
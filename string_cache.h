@@ -0,0 +1,11 @@
+/** \file string_cache.h
+*/
+
+#pragma once
+
+void create_string_cache();
+void destroy_string_cache();
+
+gboolean execute_cached_string(const gchar *str);
+
+void print_string_cache_stats(FILE *file);
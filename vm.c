@@ -0,0 +1,128 @@
+/** \file vm.c
+
+\brief Creates and destroys interpreters.
+
+A KitVM holds the state of one interpreter: its dictionary, its stacks, its
+input sources, and so on. The routines of entries find the interpreter they're
+running in through _vm, which is set per thread by use_vm. A thread may switch
+between interpreters, but an interpreter must only run on one thread at a time.
+
+Interpreters share the basic dictionary (see build_dictionary) and the
+registry of custom types. Everything else is their own, including where their
+output goes (out and err, which default to stdout and stderr).
+
+A child interpreter (see create_child_vm) also sees the words of its parent,
+including its variables. The parent must not run while it has children.
+*/
+
+
+
+// -----------------------------------------------------------------------------
+/** Creates an interpreter whose dictionary is layered on another dictionary.
+*/
+// -----------------------------------------------------------------------------
+static KitVM *create_layered_vm(const Dictionary *parent) {
+    KitVM *result = g_new0(KitVM, 1);
+    result->mode = 'E';
+    result->out = stdout;
+    result->err = stderr;
+    result->dictionary = new_dictionary(parent);
+
+    KitVM *vm_prev = use_vm(result);
+    create_stack();
+    create_stack_r();
+    create_string_cache();
+    use_vm(vm_prev);
+
+    return result;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Creates an interpreter with empty stacks and its own dictionary.
+
+The basic dictionary must already be built. This doesn't change which
+interpreter the calling thread is running.
+*/
+// -----------------------------------------------------------------------------
+KitVM *create_vm() {
+    return create_layered_vm(get_base_dictionary());
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Creates an interpreter that starts with the words of another one.
+
+The child has its own stacks, and the words it defines are its own, but it
+finds the parent's words (and shares the parent's variables).
+*/
+// -----------------------------------------------------------------------------
+KitVM *create_child_vm(const KitVM *parent) {
+    return create_layered_vm(parent->dictionary);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Makes an interpreter the one that the calling thread runs.
+
+\param vm: The interpreter (or NULL for none)
+\returns The interpreter the thread was running before
+*/
+// -----------------------------------------------------------------------------
+KitVM *use_vm(KitVM *vm) {
+    KitVM *result = _vm;
+    _vm = vm;
+    return result;
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Frees an interpreter along with everything on its stacks and in its dictionary.
+
+The interpreter must not be running on any thread.
+*/
+// -----------------------------------------------------------------------------
+void destroy_vm(KitVM *vm) {
+    KitVM *vm_prev = use_vm(vm);
+
+    destroy_input_stack();
+    destroy_stack_r();
+    destroy_stack();
+    clear_quotations();
+    clear_control_frames();
+    merge_pair_profile();
+    if (vm->current_start_note) {
+        free_note(vm->current_start_note);
+    }
+
+    // Compiled strings refer to entries in the dictionary, so they go first
+    destroy_string_cache();
+    free_dictionary(vm->dictionary);
+
+    use_vm(vm_prev == vm ? NULL : vm_prev);
+    g_free(vm);
+}
+
+
+
+// -----------------------------------------------------------------------------
+/** Runs the thread's interpreter until its input runs out or it quits.
+
+This is the main control loop: it gets a token from the input stream and
+processes it, over and over.
+*/
+// -----------------------------------------------------------------------------
+void run_vm() {
+    while(!_vm->quit) {
+        Token token = get_token();
+
+        if (token.type == EOF) break;
+        if (token.type == '^') continue;   // If EOS, keep going
+
+        process_token(token);
+    }
+}
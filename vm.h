@@ -0,0 +1,10 @@
+/** \file vm.h
+*/
+
+#pragma once
+
+KitVM *create_vm();
+KitVM *create_child_vm(const KitVM *parent);
+KitVM *use_vm(KitVM *vm);
+void destroy_vm(KitVM *vm);
+void run_vm();